@@ -0,0 +1,551 @@
+// Banco de pruebas de star: genera conjuntos de datos deterministas y mide cada operación en frío y en caliente.
+// compilar: gcc -O2 bench/bench.c -o star-bench
+// uso: star-bench [-s escala] [-r repeticiones] [-d conjunto] [-z] [-D] [-j hilos] <ruta a star> <directorio de trabajo>
+//
+// La salida estándar es JSON Lines: una línea "run" con la configuración y una línea por medición, para guardarla
+// junto a cada versión y comparar. Los mensajes de progreso van a stderr. Las llamadas al sistema que se cuentan
+// son las de lectura y escritura (syscr y syscw de /proc/<pid>/io) y el pico de memoria es ru_maxrss de star.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+
+#define DATASET_VERSION 1 // cambiar si cambia el generador, los conjuntos viejos se regeneran
+#define WRITE_CHUNK_SIZE (1024 * 1024)
+#define SPARSE_MIN_CHUNK (64 * 1024)
+#define SPARSE_DENSITY 20 // en las imágenes uno de cada 20 bytes tiene datos
+#define UPDATE_PATCH_SIZE (4 * 1024) // cada archivo de la copia modificada difiere en un trozo de este tamaño
+#define MAX_ARGS 16
+
+typedef enum { CONTENT_RANDOM, CONTENT_TEXT } ContentKind;
+
+typedef struct {
+    const char *name;
+    const char *description;
+    size_t count; // con escala 1
+} Dataset;
+
+Dataset datasets[] = {
+    {"tiny", "archivos de 0 a 4 KB, 100 por directorio", 20000},
+    {"huge", "archivos de 256 MB sin compresión posible", 4},
+    {"sparse", "imágenes de 1 GB con 5% de datos, el resto huecos", 4},
+    {"mixed", "archivos de 1 KB a 8 MB, mitad texto y mitad binarios", 500},
+};
+#define NUM_DATASETS (sizeof(datasets) / sizeof(datasets[0]))
+
+typedef struct {
+    char name[64]; // relativo al directorio del conjunto: la primera mitad en a/, la segunda en b/
+    uint64_t size;
+    ContentKind kind;
+    bool sparse;
+    uint64_t seed;
+} MemberSpec;
+
+typedef struct {
+    double scale;
+    int repeat;
+    const char *only; // un solo conjunto, o NULL para todos
+    bool compress;
+    bool dedup;
+    int jobs;
+    const char *star;
+    const char *work;
+    bool drop_caches; // /proc/sys/vm/drop_caches es escribible (root), si no se usa posix_fadvise por archivo
+} Options;
+
+typedef struct {
+    double seconds;
+    double user_seconds;
+    double system_seconds;
+    uint64_t read_syscalls;
+    uint64_t write_syscalls;
+    uint64_t read_bytes; // del dispositivo, 0 si todo salió de la caché de páginas
+    uint64_t write_bytes;
+    long peak_rss_kb;
+    int status;
+} Measure;
+
+void *xrealloc(void *pointer, size_t size) {
+    pointer = realloc(pointer, size);
+    if (pointer == NULL) {
+        fprintf(stderr, "Error: memoria insuficiente\n");
+        exit(1);
+    }
+    return pointer;
+}
+
+// generador: splitmix64, cada archivo tiene su propia semilla y sale igual en cualquier máquina
+uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+void fill_content(unsigned char *buffer, size_t length, ContentKind kind, uint64_t *state) {
+    static const char *words[] = {"bloque", "archivo", "índice", "extent", "superbloque", "registro", "hueco", "datos",
+                                  "void", "return", "size_t", "struct", "if", "for", "while", "{", "}", "0", "1", "\n"};
+    size_t i = 0;
+    if (kind == CONTENT_RANDOM) {
+        for (; i + 8 <= length; i += 8) {
+            uint64_t r = next_random(state);
+            memcpy(buffer + i, &r, 8);
+        }
+        for (; i < length; i++) buffer[i] = next_random(state);
+        return;
+    }
+    while (i < length) {
+        const char *word = words[next_random(state) % (sizeof(words) / sizeof(words[0]))];
+        for (const char *c = word; *c && i < length; c++) buffer[i++] = *c;
+        if (i < length) buffer[i++] = ' ';
+    }
+}
+
+size_t dataset_count(const Options *options, const Dataset *dataset) {
+    // los conjuntos de pocos archivos escalan el tamaño, los de muchos la cantidad
+    size_t count = dataset->count > 4 ? (size_t)(dataset->count * options->scale) : dataset->count;
+    return count < 2 ? 2 : count;
+}
+
+void member_spec(const Options *options, const Dataset *dataset, size_t index, size_t count, MemberSpec *spec) {
+    const char *half = index < count / 2 ? "a" : "b";
+    uint64_t seed = 1469598103934665603ull; // FNV-1a del nombre del conjunto, mezclado con el número de archivo
+    for (const char *c = dataset->name; *c; c++) seed = (seed ^ (unsigned char)*c) * 1099511628211ull;
+    spec->seed = seed ^ (index * 0x9e3779b97f4a7c15ull);
+    uint64_t state = spec->seed;
+    spec->kind = index % 2 ? CONTENT_TEXT : CONTENT_RANDOM;
+    spec->sparse = false;
+
+    if (strcmp(dataset->name, "tiny") == 0) {
+        snprintf(spec->name, sizeof(spec->name), "%s/d%03zu/f%05zu", half, index / 100, index);
+        spec->size = next_random(&state) % 4097;
+    } else if (strcmp(dataset->name, "huge") == 0) {
+        snprintf(spec->name, sizeof(spec->name), "%s/big%zu", half, index);
+        spec->size = (uint64_t)(256.0 * 1024 * 1024 * options->scale);
+        spec->kind = CONTENT_RANDOM;
+    } else if (strcmp(dataset->name, "sparse") == 0) {
+        snprintf(spec->name, sizeof(spec->name), "%s/disk%zu.img", half, index);
+        spec->size = (uint64_t)(1024.0 * 1024 * 1024 * options->scale);
+        spec->sparse = true;
+    } else {
+        // tamaños repartidos en escala logarítmica entre 1 KB y 8 MB
+        snprintf(spec->name, sizeof(spec->name), "%s/m%04zu%s", half, index, index % 2 ? ".txt" : ".bin");
+        spec->size = 1024ull << (next_random(&state) % 13);
+        spec->size += next_random(&state) % spec->size;
+    }
+}
+
+bool make_parents(const char *path) {
+    char *copy = strdup(path);
+    bool ok = true;
+    for (char *slash = strchr(copy + 1, '/'); ok && slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        ok = mkdir(copy, 0755) == 0 || errno == EEXIST;
+        *slash = '/';
+    }
+    free(copy);
+    return ok;
+}
+
+void write_member(const char *path, const MemberSpec *spec, bool patched) {
+    // sparse: solo se escriben trozos de 64 KB a 1 MB separados por huecos, el resto no ocupa lugar
+    int fd = make_parents(path) ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    if (fd < 0) {
+        fprintf(stderr, "Error al crear %s\n", path);
+        exit(1);
+    }
+    unsigned char *buffer = xrealloc(NULL, WRITE_CHUNK_SIZE);
+    uint64_t state = spec->seed;
+    bool ok = ftruncate(fd, spec->size) == 0;
+    for (uint64_t offset = 0; ok && offset < spec->size;) {
+        size_t length = spec->size - offset < WRITE_CHUNK_SIZE ? spec->size - offset : WRITE_CHUNK_SIZE;
+        if (spec->sparse) {
+            size_t chunk = SPARSE_MIN_CHUNK + next_random(&state) % (WRITE_CHUNK_SIZE - SPARSE_MIN_CHUNK);
+            if (chunk < length) length = chunk;
+        }
+        fill_content(buffer, length, spec->kind, &state);
+        ok = pwrite(fd, buffer, length, offset) == (ssize_t)length;
+        offset += spec->sparse ? (uint64_t)length * SPARSE_DENSITY : length;
+    }
+
+    if (ok && patched && spec->size > 0) {
+        // la copia para medir -u: el mismo contenido con un trozo alineado distinto cerca del medio
+        size_t length = spec->size < UPDATE_PATCH_SIZE ? spec->size : UPDATE_PATCH_SIZE;
+        uint64_t offset = (spec->size / 2) & ~(uint64_t)(UPDATE_PATCH_SIZE - 1);
+        if (offset + length > spec->size) offset = spec->size - length;
+        state = ~spec->seed;
+        fill_content(buffer, length, CONTENT_RANDOM, &state);
+        ok = pwrite(fd, buffer, length, offset) == (ssize_t)length;
+    }
+    free(buffer);
+    if (close(fd) != 0 || !ok) {
+        fprintf(stderr, "Error al escribir %s\n", path);
+        exit(1);
+    }
+}
+
+int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path) == 0 ? 0 : -1;
+}
+
+void remove_tree(const char *path) {
+    if (nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS) != 0 && errno != ENOENT) {
+        fprintf(stderr, "Error al borrar %s\n", path);
+        exit(1);
+    }
+}
+
+void generate_dataset(const Options *options, const Dataset *dataset, MemberSpec *specs, size_t count) {
+    // <trabajo>/<conjunto>/{a,b} es el original y <trabajo>/<conjunto>-mut/b la versión para -u; se
+    // reutilizan si ya existen con la misma versión del generador y la misma escala
+    char path[4096];
+    char stamp[128];
+    char found[128] = "";
+    snprintf(stamp, sizeof(stamp), "star-bench %d %.6f\n", DATASET_VERSION, options->scale);
+    snprintf(path, sizeof(path), "%s/%s/.stamp", options->work, dataset->name);
+    FILE *f = fopen(path, "r");
+    if (f != NULL) {
+        if (fgets(found, sizeof(found), f) == NULL) found[0] = '\0';
+        fclose(f);
+    }
+    if (strcmp(found, stamp) == 0) return;
+
+    fprintf(stderr, "Generando el conjunto %s: %zu %s\n", dataset->name, count, dataset->description);
+    snprintf(path, sizeof(path), "%s/%s", options->work, dataset->name);
+    remove_tree(path);
+    snprintf(path, sizeof(path), "%s/%s-mut", options->work, dataset->name);
+    remove_tree(path);
+    for (size_t i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%s/%s", options->work, dataset->name, specs[i].name);
+        write_member(path, &specs[i], false);
+        if (i < count / 2) continue;
+        snprintf(path, sizeof(path), "%s/%s-mut/%s", options->work, dataset->name, specs[i].name);
+        write_member(path, &specs[i], true);
+    }
+
+    snprintf(path, sizeof(path), "%s/%s/.stamp", options->work, dataset->name);
+    f = fopen(path, "w");
+    if (f == NULL || fputs(stamp, f) < 0 || fclose(f) != 0) {
+        fprintf(stderr, "Error al escribir %s\n", path);
+        exit(1);
+    }
+}
+
+// caché de páginas: en frío se vacía antes de cada medición, en caliente se lee todo lo que la operación va a tocar
+int drop_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)ftw;
+    if (flag != FTW_F || !S_ISREG(st->st_mode)) return 0;
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    return 0;
+}
+
+int warm_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)ftw;
+    if (flag != FTW_F || !S_ISREG(st->st_mode)) return 0;
+    static unsigned char buffer[WRITE_CHUNK_SIZE];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    for (off_t offset = 0;; offset += WRITE_CHUNK_SIZE) {
+        // los huecos no se leen, igual que star
+        off_t data = lseek(fd, offset, SEEK_DATA);
+        if (data < 0) break;
+        offset = data;
+        if (pread(fd, buffer, WRITE_CHUNK_SIZE, offset) <= 0) break;
+    }
+    close(fd);
+    return 0;
+}
+
+void prepare_cache(const Options *options, char **paths, size_t num_paths, bool cold) {
+    // paths: lo que pertenece al conjunto medido (directorios y archivos empacados), el resto del trabajo no se toca
+    if (!cold) {
+        for (size_t i = 0; i < num_paths; i++) nftw(paths[i], warm_entry, 64, FTW_PHYS);
+        return;
+    }
+    sync(); // DONTNEED no suelta paginas sucias
+    if (options->drop_caches) {
+        int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+        if (fd >= 0 && write(fd, "3", 1) == 1) {
+            close(fd);
+            return;
+        }
+        if (fd >= 0) close(fd);
+    }
+    for (size_t i = 0; i < num_paths; i++) nftw(paths[i], drop_entry, 64, FTW_PHYS);
+}
+
+bool read_process_io(pid_t pid, Measure *measure) {
+    // el proceso ya terminó pero todavia no se recogió (WNOWAIT), sus contadores siguen en /proc
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return false;
+    char line[128];
+    unsigned long long value;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "syscr: %llu", &value) == 1) measure->read_syscalls = value;
+        else if (sscanf(line, "syscw: %llu", &value) == 1) measure->write_syscalls = value;
+        else if (sscanf(line, "read_bytes: %llu", &value) == 1) measure->read_bytes = value;
+        else if (sscanf(line, "write_bytes: %llu", &value) == 1) measure->write_bytes = value;
+    }
+    fclose(f);
+    return true;
+}
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+Measure run_star(const Options *options, const char *directory, char **args, size_t num_args, char **names, size_t num_names) {
+    // star corre en <directorio> con la salida estándar a /dev/null: se mide la operación, no la terminal
+    size_t argc = 0;
+    char **argv = xrealloc(NULL, (MAX_ARGS + num_names + 1) * sizeof(char *));
+    argv[argc++] = (char *)options->star;
+    for (size_t i = 0; i < num_args; i++) argv[argc++] = args[i];
+    for (size_t i = 0; i < num_names; i++) argv[argc++] = names[i];
+    argv[argc] = NULL;
+
+    Measure measure = {0};
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (chdir(directory) != 0 || null < 0 || dup2(null, STDOUT_FILENO) < 0) _exit(126);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (pid < 0) {
+        fprintf(stderr, "Error al ejecutar %s\n", options->star);
+        exit(1);
+    }
+    siginfo_t info;
+    while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) != 0 && errno == EINTR) {}
+    measure.seconds = now_seconds() - start;
+    read_process_io(pid, &measure);
+
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {}
+    measure.user_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    measure.system_seconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    measure.peak_rss_kb = usage.ru_maxrss;
+    measure.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    free(argv);
+    return measure;
+}
+
+uint64_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+void report(const Dataset *dataset, const char *op, bool cold, int repetition, size_t files, uint64_t bytes, uint64_t archive_bytes,
+            const Measure *m) {
+    double seconds = m->seconds > 0 ? m->seconds : 1e-9;
+    printf("{\"dataset\":\"%s\",\"op\":\"%s\",\"cache\":\"%s\",\"repetition\":%d,\"files\":%zu,\"bytes\":%llu,"
+           "\"seconds\":%.6f,\"mb_s\":%.2f,\"ops_s\":%.1f,\"user_s\":%.3f,\"sys_s\":%.3f,"
+           "\"read_syscalls\":%llu,\"write_syscalls\":%llu,\"disk_read_bytes\":%llu,\"disk_write_bytes\":%llu,"
+           "\"peak_rss_kb\":%ld,\"archive_bytes\":%llu,\"status\":%d}\n",
+           dataset->name, op, cold ? "cold" : "warm", repetition, files, (unsigned long long)bytes, m->seconds,
+           bytes / 1048576.0 / seconds, files / seconds, m->user_seconds, m->system_seconds, (unsigned long long)m->read_syscalls,
+           (unsigned long long)m->write_syscalls, (unsigned long long)m->read_bytes, (unsigned long long)m->write_bytes,
+           m->peak_rss_kb, (unsigned long long)archive_bytes, m->status);
+    fflush(stdout);
+    if (m->status != 0) fprintf(stderr, "Aviso: %s en %s terminó con estado %d\n", op, dataset->name, m->status);
+}
+
+void bench_dataset(const Options *options, const Dataset *dataset) {
+    size_t count = dataset_count(options, dataset);
+    MemberSpec *specs = xrealloc(NULL, count * sizeof(MemberSpec));
+    for (size_t i = 0; i < count; i++) member_spec(options, dataset, i, count, &specs[i]);
+    generate_dataset(options, dataset, specs, count);
+
+    // la segunda mitad (b/) es la que se agrega, se actualiza y se borra
+    char **names = xrealloc(NULL, count * sizeof(char *));
+    size_t num_b = 0;
+    uint64_t bytes_all = 0, bytes_b = 0;
+    for (size_t i = 0; i < count; i++) {
+        bytes_all += specs[i].size;
+        if (i < count / 2) continue;
+        names[num_b++] = specs[i].name;
+        bytes_b += specs[i].size;
+    }
+
+    char directory[4096], mutated[4096], out[4096], archive[4096], archive2[4096];
+    snprintf(directory, sizeof(directory), "%s/%s", options->work, dataset->name);
+    snprintf(mutated, sizeof(mutated), "%s/%s-mut", options->work, dataset->name);
+    snprintf(out, sizeof(out), "%s/out", options->work);
+    snprintf(archive, sizeof(archive), "%s/%s.star", options->work, dataset->name);
+    snprintf(archive2, sizeof(archive2), "%s/%s-2.star", options->work, dataset->name);
+    char *touched[] = {directory, mutated, archive, archive2};
+
+    char jobs[16];
+    snprintf(jobs, sizeof(jobs), "%d", options->jobs);
+    char *ingest[MAX_ARGS]; // opciones de las operaciones que guardan datos
+    size_t num_ingest = 0;
+    if (options->compress) ingest[num_ingest++] = "-z";
+    if (options->dedup) ingest[num_ingest++] = "-D";
+    ingest[num_ingest++] = "-j";
+    ingest[num_ingest++] = jobs;
+
+    for (int repetition = 0; repetition < options->repeat; repetition++) {
+        for (int cold = 1; cold >= 0; cold--) {
+            char *args[MAX_ARGS];
+            size_t n;
+            char *both[] = {"a", "b"};
+            char *half_a[] = {"a"};
+            char *half_b[] = {"b"};
+            Measure m;
+
+            fprintf(stderr, "%s, %s, repetición %d\n", dataset->name, cold ? "en frío" : "en caliente", repetition + 1);
+            unlink(archive);
+            n = 0;
+            args[n++] = "-cf";
+            for (size_t i = 0; i < num_ingest; i++) args[n++] = ingest[i];
+            args[n++] = archive;
+            prepare_cache(options, touched, 4, cold);
+            m = run_star(options, directory, args, n, both, 2);
+            report(dataset, "create", cold, repetition, count, bytes_all, file_size(archive), &m);
+
+            n = 0;
+            args[n++] = "-tf";
+            args[n++] = archive;
+            prepare_cache(options, touched, 4, cold);
+            m = run_star(options, directory, args, n, NULL, 0);
+            report(dataset, "list", cold, repetition, count, 0, file_size(archive), &m);
+
+            remove_tree(out);
+            if (mkdir(out, 0755) != 0) {
+                fprintf(stderr, "Error al crear %s\n", out);
+                exit(1);
+            }
+            n = 0;
+            args[n++] = "-xf";
+            args[n++] = "-j";
+            args[n++] = jobs;
+            args[n++] = archive;
+            prepare_cache(options, touched, 4, cold);
+            m = run_star(options, out, args, n, NULL, 0);
+            report(dataset, "extract", cold, repetition, count, bytes_all, file_size(archive), &m);
+            remove_tree(out);
+
+            n = 0;
+            args[n++] = "-df";
+            args[n++] = archive;
+            prepare_cache(options, touched, 4, cold);
+            m = run_star(options, directory, args, n, names, num_b);
+            report(dataset, "delete", cold, repetition, num_b, 0, file_size(archive), &m); // solo cambia el índice
+
+            // después de borrar la mitad hay huecos para compactar
+            uint64_t before = file_size(archive);
+            n = 0;
+            args[n++] = "-pf";
+            args[n++] = archive;
+            prepare_cache(options, touched, 4, cold);
+            m = run_star(options, directory, args, n, NULL, 0);
+            report(dataset, "pack", cold, repetition, count - num_b, before, file_size(archive), &m);
+
+            unlink(archive2);
+            n = 0;
+            args[n++] = "-cf";
+            for (size_t i = 0; i < num_ingest; i++) args[n++] = ingest[i];
+            args[n++] = archive2;
+            m = run_star(options, directory, args, n, half_a, 1);
+            if (m.status != 0) fprintf(stderr, "Aviso: no se pudo preparar %s\n", archive2);
+            n = 0;
+            args[n++] = "-rf";
+            for (size_t i = 0; i < num_ingest; i++) args[n++] = ingest[i];
+            args[n++] = archive2;
+            prepare_cache(options, touched, 4, cold);
+            m = run_star(options, directory, args, n, half_b, 1);
+            report(dataset, "append", cold, repetition, num_b, bytes_b, file_size(archive2), &m);
+
+            // desde <conjunto>-mut los mismos nombres tienen el contenido modificado
+            n = 0;
+            args[n++] = "-uf";
+            args[n++] = "-j";
+            args[n++] = jobs;
+            args[n++] = archive2;
+            prepare_cache(options, touched, 4, cold);
+            m = run_star(options, mutated, args, n, names, num_b);
+            report(dataset, "update", cold, repetition, num_b, bytes_b, file_size(archive2), &m);
+        }
+    }
+    unlink(archive);
+    unlink(archive2);
+    free(names);
+    free(specs);
+}
+
+void usage(const char *program) {
+    fprintf(stderr, "Uso: %s [-s escala] [-r repeticiones] [-d conjunto] [-z] [-D] [-j hilos] <ruta a star> <directorio de trabajo>\n", program);
+    fprintf(stderr, "Conjuntos:\n");
+    for (size_t i = 0; i < NUM_DATASETS; i++) fprintf(stderr, "  %-8s %zu %s\n", datasets[i].name, datasets[i].count, datasets[i].description);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    Options options = {1.0, 1, NULL, false, false, 1, NULL, NULL, false};
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:d:zDj:")) != -1) {
+        switch (opt) {
+            case 's': options.scale = atof(optarg); break;
+            case 'r': options.repeat = atoi(optarg); break;
+            case 'd': options.only = optarg; break;
+            case 'z': options.compress = true; break;
+            case 'D': options.dedup = true; break;
+            case 'j': options.jobs = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || options.scale <= 0 || options.repeat < 1 || options.jobs < 1) usage(argv[0]);
+
+    options.star = realpath(argv[optind], NULL);
+    if (options.star == NULL || access(options.star, X_OK) != 0) {
+        fprintf(stderr, "Error: no se encuentra el ejecutable %s\n", argv[optind]);
+        return 1;
+    }
+    if (mkdir(argv[optind + 1], 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error al crear el directorio de trabajo %s\n", argv[optind + 1]);
+        return 1;
+    }
+    options.work = realpath(argv[optind + 1], NULL);
+    options.drop_caches = access("/proc/sys/vm/drop_caches", W_OK) == 0;
+
+    struct utsname system;
+    uname(&system);
+    printf("{\"run\":{\"time\":%lld,\"star\":\"%s\",\"kernel\":\"%s %s\",\"cpus\":%ld,\"dataset_version\":%d,\"scale\":%g,"
+           "\"repeat\":%d,\"compress\":%s,\"dedup\":%s,\"jobs\":%d,\"cold_cache\":\"%s\"}}\n",
+           (long long)time(NULL), options.star, system.sysname, system.release, sysconf(_SC_NPROCESSORS_ONLN), DATASET_VERSION,
+           options.scale, options.repeat, options.compress ? "true" : "false", options.dedup ? "true" : "false", options.jobs,
+           options.drop_caches ? "drop_caches" : "fadvise");
+
+    bool found = false;
+    for (size_t i = 0; i < NUM_DATASETS; i++) {
+        if (options.only != NULL && strcmp(options.only, datasets[i].name) != 0) continue;
+        found = true;
+        bench_dataset(&options, &datasets[i]);
+    }
+    if (!found) usage(argv[0]);
+    return 0;
+}
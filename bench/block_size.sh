@@ -0,0 +1,51 @@
+#!/usr/bin/env bash
+# Compara tamaños de bloque: velocidad de creación y extracción y espacio extra sobre los datos.
+# Uso: bench/block_size.sh [ruta a star] [directorio de trabajo]
+# Conjuntos: "pequeños" (2000 archivos de 1-16 KB), "mixto" (código fuente + algunos binarios) y "medios" (2 archivos de 256 MB).
+set -e
+
+STAR=$(realpath "${1:-./star}")
+WORK=${2:-/tmp/star-bench}
+SIZES="4K 16K 64K 256K 1M 4M 16M"
+
+rm -rf "$WORK" && mkdir -p "$WORK" && cd "$WORK"
+
+# datos deterministas: la misma semilla genera los mismos archivos en cada corrida
+random_bytes() { # <bytes> <semilla>
+    openssl enc -aes-128-ctr -nosalt -pass "pass:$2" -pbkdf2 < /dev/zero 2>/dev/null | head -c "$1"
+}
+
+mkdir small mixed media
+for i in $(seq 1 2000); do random_bytes $(( (i * 7919) % 15360 + 1024 )) "s$i" > small/f$i; done
+for i in $(seq 1 300); do seq "$i" $(( i * 40 )) > mixed/src$i.txt; done
+for i in $(seq 1 20); do random_bytes $(( i * 1048576 )) "m$i" > mixed/bin$i; done
+for i in 1 2; do random_bytes $(( 256 * 1048576 )) "v$i" > media/v$i; done
+
+now() { date +%s%N; }
+mb_per_s() { # <bytes> <ns>
+    awk -v b="$1" -v ns="$2" 'BEGIN { printf "%.1f", (ns > 0 ? b / 1048576 / (ns / 1e9) : 0) }'
+}
+
+printf "%-8s %-8s %12s %12s %12s %10s\n" conjunto bloque "crear MB/s" "extraer MB/s" "archivo" "extra %"
+for set in small mixed media; do
+    data_bytes=$(du -cb "$set" | tail -1 | cut -f1)
+    for bs in $SIZES; do
+        rm -f ar && sync
+        start=$(now)
+        (cd "$set" && "$STAR" -cf -b "$bs" ../ar *)
+        sync
+        create_ns=$(( $(now) - start ))
+
+        rm -rf out && mkdir out
+        start=$(now)
+        (cd out && "$STAR" -xf ../ar)
+        extract_ns=$(( $(now) - start ))
+
+        archive_bytes=$(stat -c %s ar)
+        overhead=$(awk -v a="$archive_bytes" -v d="$data_bytes" 'BEGIN { printf "%.1f", (a - d) * 100 / d }')
+        printf "%-8s %-8s %12s %12s %12s %10s\n" "$set" "$bs" "$(mb_per_s "$data_bytes" "$create_ns")" \
+            "$(mb_per_s "$data_bytes" "$extract_ns")" "$archive_bytes" "$overhead"
+    done
+done
+
+cd / && rm -rf "$WORK"
@@ -0,0 +1,217 @@
+// línea de comandos: gcc -O2 main.c star.c -o star -lpthread
+#include <stdio.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include "star.h"
+
+struct Flags {
+    bool create;
+    bool extract;
+    bool list;
+    bool delete;
+    bool update;
+    bool verbose;
+    bool veryVerbose;
+    bool file;
+    bool append;
+    bool pack;
+    bool dedup;
+    bool verify;
+    bool toStdout;
+    bool stream;
+    bool direct; // --direct: bloques alineados del archivo empacado con O_DIRECT
+    bool syncIo; // --sync-io: pread/pwrite de a uno aunque haya io_uring
+    bool json; // --json: -t escribe un objeto JSON por archivo
+    int sort; // --sort: orden de -t, LIST_SORT_*
+    int stats; // 0 sin --stats, 1 en texto, 2 en JSON
+    int jobs;
+    int codec; // -1 si no se pidió compresión
+    size_t blockSize; // solo se usa al crear
+    char *outputFile;
+    char **inputFiles;
+    int numInputFiles;
+};
+
+size_t parse_size(const char *text) {
+    // número con sufijo opcional K o M (ej. 64K, 1M)
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text) return 0;
+    if (*end == 'k' || *end == 'K') {
+        value *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        value *= 1024 * 1024;
+        end++;
+    }
+    return *end == '\0' ? value : 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct Flags flags = {false, false, false, false, false, false, false, false, false, false, false, false, false, false, false, false, false, LIST_SORT_NONE, 0, 1, -1, DEFAULT_BLOCK_SIZE, NULL, NULL, 0};
+    int opt;
+
+    static struct option long_options[] = {
+        {"create",      no_argument,       0, 'c'},
+        {"extract",     no_argument,       0, 'x'},
+        {"list",        no_argument,       0, 't'},
+        {"delete",      no_argument,       0, 'd'},
+        {"update",      no_argument,       0, 'u'},
+        {"verbose",     no_argument,       0, 'v'},
+        {"file",        no_argument,       0, 'f'},
+        {"append",      no_argument,       0, 'r'},
+        {"pack",        no_argument,       0, 'p'},
+        {"jobs",        required_argument, 0, 'j'},
+        {"compress",    optional_argument, 0, 'z'},
+        {"block-size",  required_argument, 0, 'b'},
+        {"dedup",       no_argument,       0, 'D'},
+        {"verify",      no_argument,       0, 'V'},
+        {"to-stdout",   no_argument,       0, 'O'},
+        {"stream",      no_argument,       0, 'S'},
+        {"stats",       optional_argument, 0, 's'},
+        {"direct",      no_argument,       0, 'I'},
+        {"sync-io",     no_argument,       0, 'Y'},
+        {"json",        no_argument,       0, 'J'},
+        {"sort",        optional_argument, 0, 'R'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "cxtduvwfrpDVOSj:zb:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                flags.create = true;
+                break;
+            case 'x':
+                flags.extract = true;
+                break;
+            case 't':
+                flags.list = true;
+                break;
+            case 'd':
+                flags.delete = true;
+                break;
+            case 'u':
+                flags.update = true;
+                break;
+            case 'v':
+                if (flags.verbose) {
+                    flags.veryVerbose = true;
+                }
+                flags.verbose = true;
+                break;
+            case 'f':
+                flags.file = true;
+                break;
+            case 'r':
+                flags.append = true;
+                break;
+            case 'p':
+                flags.pack = true;
+                break;
+            case 'D':
+                flags.dedup = true;
+                break;
+            case 'V':
+                flags.verify = true;
+                break;
+            case 'O':
+                flags.toStdout = true;
+                break;
+            case 'S':
+                flags.stream = true;
+                break;
+            case 'I': // solo como --direct
+                flags.direct = true;
+                break;
+            case 'Y': // solo como --sync-io
+                flags.syncIo = true;
+                break;
+            case 'J': // solo como --json
+                flags.json = true;
+                break;
+            case 'R': // solo como --sort o --sort=size
+                if (optarg != NULL && strcmp(optarg, "name") != 0 && strcmp(optarg, "size") != 0) {
+                    fprintf(stderr, "Orden de --sort desconocido: %s (name o size)\n", optarg);
+                    return 1;
+                }
+                flags.sort = optarg != NULL && strcmp(optarg, "size") == 0 ? LIST_SORT_SIZE : LIST_SORT_NAME;
+                break;
+            case 's': // solo como --stats o --stats=json
+                if (optarg != NULL && strcmp(optarg, "json") != 0 && strcmp(optarg, "text") != 0) {
+                    fprintf(stderr, "Formato de --stats desconocido: %s (text o json)\n", optarg);
+                    return 1;
+                }
+                flags.stats = optarg != NULL && strcmp(optarg, "json") == 0 ? 2 : 1;
+                break;
+            case 'z':
+                flags.codec = optarg ? find_codec(optarg) : CODEC_LZ;
+                if (flags.codec < 0) {
+                    fprintf(stderr, "Codec de compresión desconocido: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'j':
+                flags.jobs = atoi(optarg);
+                if (flags.jobs < 1) flags.jobs = 1;
+                break;
+            case 'b':
+                flags.blockSize = parse_size(optarg);
+                if (!valid_block_size(flags.blockSize)) {
+                    fprintf(stderr, "Tamaño de bloque inválido: %s (potencia de 2 entre 4K y 16M)\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-cxtduvvfrpzDVOS] [-j N] [-b SIZE] [--stats[=json]] [--direct] [--sync-io] [--json] [--sort[=size]] <outputFile> <inputFile1> ... <inputFileN>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind < argc) {
+        flags.outputFile = argv[optind++];
+    }
+
+    flags.numInputFiles = argc - optind;
+    if (flags.numInputFiles > 0) {
+        flags.inputFiles = &argv[optind];
+    }
+
+    if (flags.stats) star_stats_enable();
+    star_io_configure(!flags.syncIo, flags.direct);
+    int status = 0;
+
+    if (flags.stream) {
+        // el flujo se escribe o se lee una sola vez de principio a fin: no admite cambios en el lugar
+        if (flags.outputFile == NULL || flags.delete || flags.update || flags.append || flags.pack || flags.verify) {
+            fprintf(stderr, "Con -S solo se puede crear (-c), extraer (-x) o listar (-t) un flujo, \"-\" es la entrada o salida estándar\n");
+            return 1;
+        }
+        bool ok = true;
+        if (flags.create) ok = pipe_create_archive(flags.outputFile, flags.inputFiles, flags.file ? flags.numInputFiles : 0, flags.codec, flags.verbose);
+        else if (flags.extract) ok = pipe_extract_archive(flags.outputFile, flags.inputFiles, flags.numInputFiles, flags.toStdout, flags.verbose);
+        else if (flags.list) ok = pipe_list_archive(flags.outputFile, flags.verbose);
+        status = ok ? 0 : 1;
+    } else {
+        if (flags.create) create_archive(flags.outputFile, flags.inputFiles, flags.file ? flags.numInputFiles : 0, flags.codec, flags.dedup, flags.blockSize, flags.jobs, flags.verbose, flags.veryVerbose);
+        else if (flags.extract && !extract_archive(flags.outputFile, flags.inputFiles, flags.numInputFiles, flags.toStdout, flags.jobs, flags.verbose, flags.veryVerbose)) status = 1;
+        else if (flags.delete) delete_files_from_archive(flags.outputFile, flags.inputFiles, flags.numInputFiles, flags.verbose, flags.veryVerbose);
+        else if (flags.update && !update_files_in_archive(flags.outputFile, flags.inputFiles, flags.numInputFiles, flags.codec, flags.dedup, flags.jobs, flags.verbose, flags.veryVerbose)) status = 1;
+        else if (flags.append && !append_files_to_archive(flags.outputFile, flags.inputFiles, flags.numInputFiles, flags.codec, flags.dedup, flags.jobs, flags.verbose, flags.veryVerbose)) status = 1;
+
+        if (status == 0) {
+            if (flags.pack) defragment_archive(flags.outputFile, flags.verbose, flags.veryVerbose);
+            // solo con -t los nombres de la línea de comandos son filtros del listado
+            bool onlyList = !flags.create && !flags.extract && !flags.delete && !flags.update && !flags.append;
+            if (flags.list && !list_archive_contents(flags.outputFile, onlyList ? flags.inputFiles : NULL, onlyList ? flags.numInputFiles : 0,
+                                                     flags.sort, flags.json, flags.verbose)) {
+                status = 1;
+            }
+            if (flags.verify && !verify_archive(flags.outputFile, flags.jobs, flags.verbose)) status = 1;
+        }
+    }
+
+    if (flags.stats) star_stats_report(flags.stats == 2);
+    return status;
+}
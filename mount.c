@@ -0,0 +1,72 @@
+// montar un archivo empacado de solo lectura:
+// gcc -O2 mount.c star.c -o star-mount $(pkg-config --cflags --libs fuse3) -lpthread
+#define FUSE_USE_VERSION 31
+#include <fuse.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include "star.h"
+
+#define MOUNT_CACHE_SIZE (256 * 1024 * 1024) // bloques descomprimidos compartidos por todos los archivos abiertos
+
+StarFs *mounted;
+
+typedef struct {
+    void *buffer;
+    fuse_fill_dir_t filler;
+} MountDir;
+
+int mount_getattr(const char *path, struct stat *st, struct fuse_file_info *fi) {
+    (void)fi;
+    return starfs_getattr(mounted, path, st);
+}
+
+int mount_fill(void *context, const char *name, const struct stat *st) {
+    MountDir *dir = context;
+    return dir->filler(dir->buffer, name, st, 0, 0);
+}
+
+int mount_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+    (void)offset;
+    (void)fi;
+    (void)flags;
+    MountDir dir = {buffer, filler};
+    return starfs_readdir(mounted, path, &dir, mount_fill);
+}
+
+int mount_readlink(const char *path, char *buffer, size_t size) {
+    return starfs_readlink(mounted, path, buffer, size);
+}
+
+int mount_open(const char *path, struct fuse_file_info *fi) {
+    int status = starfs_open(mounted, path, fi->flags);
+    if (status == 0) fi->keep_cache = 1; // el contenido no cambia: el kernel puede conservar sus paginas entre aperturas
+    return status;
+}
+
+int mount_read(const char *path, char *buffer, size_t size, off_t offset, struct fuse_file_info *fi) {
+    (void)fi;
+    return starfs_read(mounted, path, buffer, size, offset);
+}
+
+const struct fuse_operations mount_operations = {
+    .getattr = mount_getattr,
+    .readdir = mount_readdir,
+    .readlink = mount_readlink,
+    .open = mount_open,
+    .read = mount_read,
+};
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <archivo empacado> <punto de montaje> [opciones de FUSE]\n", argv[0]);
+        return 1;
+    }
+    mounted = starfs_mount(argv[1], MOUNT_CACHE_SIZE);
+    if (mounted == NULL) return 1;
+
+    // FUSE recibe el resto de los argumentos, sin el archivo empacado
+    argv[1] = argv[0];
+    int status = fuse_main(argc - 1, argv + 1, &mount_operations, NULL);
+    starfs_unmount(mounted);
+    return status;
+}
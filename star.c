@@ -1,628 +1,5330 @@
+#define _GNU_SOURCE // copy_file_range
 #include <stdio.h>
 #include <unistd.h>
 #include <stdbool.h>
-#include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <fnmatch.h>
+#include <sys/sendfile.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <stdarg.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "star.h"
 
-#define BLOCK_SIZE 256 * 1024 // 256 KB
-#define MAX_FILES 100 
-#define MAX_FILENAME_LENGTH 256
-#define MAX_BLOCKS_PER_FILE 64 
-#define MAX_BLOCKS MAX_BLOCKS_PER_FILE * MAX_FILES
+#define MIN_BLOCK_SIZE (4 * 1024)
+#define MAX_BLOCK_SIZE (16 * 1024 * 1024)
+#define GROWTH_CHUNK_SIZE (64 * 1024 * 1024) // crecer el archivo empacado de a 64 MB
+#define EXTRACT_SPLIT_SIZE (64 * 1024 * 1024) // los archivos grandes se extraen en paralelo en trozos de 64 MB
+#define VERIFY_READ_SIZE (8 * 1024 * 1024) // cada hilo de --verify lee de a 8 MB seguidos
+#define STDOUT_WRITE_SIZE (4 * 1024 * 1024) // -O escribe a la salida estándar de a 4 MB
+#define PIPE_CHUNK_SIZE (256 * 1024) // -S: los datos van en trozos de 256 KB, cada uno con su hash
+#define IO_READ_SIZE (1024 * 1024) // las lecturas grandes se parten en pedidos de 1 MB para tener varios en vuelo
+#define IO_EXTRACT_DEPTH 8 // bloques descomprimidos en vuelo hacia la salida por cada hilo de extracción
+#define IO_COPY_DEPTH 8 // trozos de IO_READ_SIZE en vuelo al mover datos sin copy_file_range
+
+#ifndef STAR_TRACE
+#define STAR_TRACE 0 // compilar con -DSTAR_TRACE=1 para que -vv muestre cada bloque; si no, esos printf no existen
+#endif
+#define TRACE_BLOCK(enabled, ...) do { if (STAR_TRACE && (enabled)) printf(__VA_ARGS__); } while (0)
+
+#define STAR_MAGIC 0x52415453 // "STAR" en little endian
+#define STAR_VERSION 3 // sin superbloque es el formato antiguo de FAT fija, que se sigue leyendo
+#define SUPERBLOCK_SIZE 4096 // espacio reservado al inicio del archivo para el superbloque
+#define SB_DEDUP 0x1 // hay bloques compartidos entre archivos, solo se liberan cuando nadie mas los usa
+#define SB_METADATA 0x2 // los registros del índice pueden llevar tipo, permisos, dueño y fecha (RECORD_METADATA)
+#define SB_SPARSE 0x4 // hay archivos con huecos: bloques de ceros que no ocupan lugar (FRAME_HOLE)
+#define SB_KNOWN_FLAGS (SB_DEDUP | SB_METADATA | SB_SPARSE)
+#define SUPERBLOCK_SLOT 2048 // dos copias del superbloque que se escriben alternadas, vale la valida de mayor generación
+
+#define JOURNAL_MIN_SIZE (64 * 1024) // registro de cambios del índice, al llenarse se guarda el índice completo
+#define JOURNAL_BATCH_SIZE (16 * 1024) // registros que se confirman juntos con un solo par de fdatasync
+#define JOURNAL_ALIGN 4096 // el registro empieza en una pagina propia despues del índice
+#define JOURNAL_PUT 1 // estado completo de un archivo, igual que en el índice
+#define JOURNAL_DELETE 2 // nombre del archivo borrado
+#define JOURNAL_MOVE 3 // bloques movidos por la desfragmentación
+
+// formato de flujo (-S): se escribe y se lee de principio a fin, sirve para tuberías y cintas
+#define PIPE_MAGIC 0x4d525453 // "STRM"
+#define PIPE_END_MAGIC 0x45525453 // "STRE"
+#define PIPE_VERSION 1
+#define PIPE_MEMBER 1 // cabecera de un archivo, la siguen su nombre y sus trozos
+#define PIPE_INDEX 2 // índice final, la siguen las entradas y el pie
+#define PIPE_SIZE_UNKNOWN UINT64_MAX
+
+// formato antiguo (version 1): FAT de tamaño fijo al inicio del archivo, solo se lee para migrar
+#define LEGACY_MAX_FILES 100
+#define LEGACY_MAX_FILENAME_LENGTH 256
+#define LEGACY_MAX_BLOCKS_PER_FILE 64
+#define LEGACY_MAX_BLOCKS LEGACY_MAX_BLOCKS_PER_FILE * LEGACY_MAX_FILES
+#define LEGACY_BLOCK_SIZE (256 * 1024)
+
+#define RECORD_CODEC_MASK 0xff
+#define RECORD_PACKED 0x100 // el archivo comparte su bloque con otros, el registro termina con su desplazamiento (uint32_t)
+#define RECORD_HASHES 0x200 // despues de los tamaños comprimidos va un hash (uint64_t) del contenido de cada bloque
+#define RECORD_METADATA 0x400 // el registro termina con un EntryMetadata
+#define RECORD_FRAMES 0x800 // lleva tamaños de bloque aunque no esté comprimido, porque tiene huecos
+#define PACK_THRESHOLD(block_size) ((block_size) / 2) // los archivos que ocupan menos que esto se empaquetan en bloques compartidos
+#define FRAME_RAW 0x80000000u // el bloque no se pudo comprimir y se guardó tal cual
+#define FRAME_SIZE_MASK 0x7fffffffu
+#define FRAME_HOLE 0 // bloque de ceros, no ocupa lugar en los datos del archivo
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16) // peor caso de salida del compresor
+
+typedef struct {
+    char filename[LEGACY_MAX_FILENAME_LENGTH];
+    size_t file_size;
+    size_t block_positions[LEGACY_MAX_BLOCKS_PER_FILE];
+    size_t num_blocks;
+} LegacyFileEntry;
+
+typedef struct {
+    LegacyFileEntry files[LEGACY_MAX_FILES];
+    size_t num_files;
+    size_t free_blocks[LEGACY_MAX_BLOCKS];
+    size_t num_free_blocks;
+} LegacyFAT;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t flags; // funciones que cambian como se interpreta el índice (SB_*)
+    uint64_t data_start; // posición del primer bloque de datos
+    uint64_t index_offset; // posición del índice serializado
+    uint64_t index_length; // largo en bytes del índice
+    uint64_t num_files;
+    uint64_t journal_offset; // registro de cambios desde el ultimo índice completo, 0 si no hay
+    uint64_t journal_capacity; // bytes reservados para el registro
+    uint64_t journal_sequence; // los registros de otra generación ya están incluidos en el índice
+    uint64_t generation; // la copia con la mayor generación es la vigente
+    uint64_t checksum; // del superbloque con este campo en 0
+} Superblock;
+
+// cada cambio del índice se agrega al registro como encabezado + datos, despues de que los datos de los
+// archivos que menciona ya llegaron al disco
+typedef struct {
+    uint32_t type;
+    uint32_t length; // bytes de datos despues del encabezado
+    uint64_t sequence;
+    uint64_t checksum; // del encabezado con este campo en 0 y de los datos
+} JournalHeader;
+
+typedef struct {
+    uint64_t source;
+    uint64_t target;
+    uint64_t num_blocks;
+} JournalMove;
+
+// registro de cada archivo en el índice, seguido del nombre (sin \0), de num_extents pares (posición, bloques),
+// si el archivo está comprimido del tamaño almacenado de cada bloque (uint32_t), si está empaquetado de su desplazamiento
+// y si se conocen de sus metadatos
+typedef struct {
+    uint32_t name_length;
+    uint32_t flags; // codec de compresión en los 8 bits bajos
+    uint64_t file_size;
+    uint64_t num_extents;
+} IndexRecord;
+
+typedef struct {
+    size_t position; // posición del primer bloque del extent
+    size_t num_blocks; // cantidad de bloques contiguos
+} Extent;
+
+typedef struct {
+    uint32_t mode; // tipo y permisos como st_mode, 0 si no se conocen (versiones anteriores o stdin)
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t mtime_nsec;
+    int64_t mtime;
+} EntryMetadata;
 
 typedef struct {
-    char filename[MAX_FILENAME_LENGTH];
+    char *filename;
     size_t file_size;
-    size_t block_positions[MAX_BLOCKS_PER_FILE];
-    size_t num_blocks; 
+    Extent *extents; // bloques del archivo en orden, agrupados en corridas contiguas
+    size_t num_extents;
+    size_t extents_capacity;
+    size_t num_blocks; // total de bloques entre todos los extents
+    int codec;
+    uint32_t *frames; // con compresión: tamaño almacenado de cada bloque, los bloques van seguidos uno tras otro en los extents
+    uint64_t *frame_offsets; // posición de cada bloque comprimido dentro de los datos del archivo (num_frames + 1)
+    size_t num_frames;
+    size_t frames_capacity;
+    uint64_t *hashes; // hash_block del contenido original de cada bloque, para saber que cambió al actualizar
+    size_t num_hashes;
+    size_t hashes_capacity;
+    bool packed; // vive dentro de un bloque compartido con otros archivos pequeños
+    size_t data_offset; // donde empiezan sus datos dentro del primer bloque
+    bool deleted; // lapida: la entrada se borró pero sigue ocupando su lugar hasta reescribir el índice
+    EntryMetadata metadata; // un directorio no tiene datos, un enlace simbólico guarda su destino como contenido
 } FileEntry;
 
-typedef struct {
-    FileEntry files[MAX_FILES];
-    size_t num_files;
-    size_t free_blocks[MAX_BLOCKS];
-    size_t num_free_blocks;
-} FAT;
+typedef struct {
+    FileEntry *files;
+    size_t num_files; // entradas en el arreglo, incluyendo las borradas
+    size_t num_deleted;
+    size_t capacity;
+    size_t *buckets; // tabla hash nombre -> posición en files (+1), 0 es vacío
+    size_t num_buckets; // potencia de 2
+    size_t num_used_buckets; // ocupados o con lapida
+} FAT;
+
+typedef struct {
+    Extent *extents; // extents libres, ordenados por posición y coalescidos
+    size_t num_extents;
+    size_t capacity;
+    size_t archive_end; // fin del espacio reservado del archivo empacado
+    size_t block_size;
+} Allocator;
+
+typedef struct {
+    size_t position; // bloque compartido por archivos pequeños
+    size_t used; // bytes ocupados desde el inicio del bloque
+    size_t live_members; // el bloque se libera cuando llega a 0
+} Slab;
+
+typedef struct {
+    uint64_t key;
+    uint64_t value;
+    uint32_t refs;
+    bool used;
+} BlockSlot;
+
+typedef struct {
+    BlockSlot *slots; // direccionamiento abierto, sin borrados: una entrada sin referencias queda con refs en 0
+    size_t num_slots; // potencia de 2
+    size_t count;
+} BlockTable;
+
+#define IO_DIRECT_ALIGN 4096 // O_DIRECT: dirección, posición y largo alineados a esto, si no va por la caché
+
+typedef void (*IoDone)(void *context, bool ok); // se llama desde io_queue o io_wait en el hilo del motor
+
+typedef struct {
+    int fd;
+    unsigned char *data;
+    size_t length;
+    size_t offset;
+    bool write;
+    IoDone done;
+    void *context;
+} IoRequest;
+
+typedef struct {
+    int ring_fd;
+    unsigned depth; // 0: síncrono
+    unsigned in_flight;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring; // igual a sq_ring con IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    size_t sqes_size;
+    IoRequest *requests; // uno por lugar de la cola, user_data es el índice
+    unsigned *free_slots;
+    unsigned num_free;
+    struct iovec *buffers; // registrados con el kernel, se usan con READ_FIXED y WRITE_FIXED
+    unsigned num_buffers;
+    int direct_source; // pedidos sobre este fd que estén alineados van por direct_fd (O_DIRECT)
+    int direct_fd;
+} IoEngine;
+
+typedef struct {
+    FILE *file;
+    Superblock sb;
+    FAT fat;
+    Allocator alloc; // solo se arma si el archivo se abre para escritura
+    Slab *slabs; // ordenados por posición, también solo para escritura
+    size_t num_slabs;
+    size_t slabs_capacity;
+    bool dedup; // -D: los bloques con un contenido que ya está en el archivo no se vuelven a escribir
+    BlockTable block_refs; // posición -> hash y cantidad de referencias, solo con SB_DEDUP
+    BlockTable block_hashes; // hash -> posición de un bloque con ese contenido
+    unsigned char *dedup_buffer; // para comparar el bloque candidato antes de compartirlo
+    size_t dedup_blocks; // bloques que no se escribieron por estar repetidos
+    bool writable;
+    bool defragmenting; // el índice y el registro van al final del archivo
+    bool needs_checkpoint; // el índice en disco no sirve de base para el registro (archivo nuevo o del formato antiguo)
+    unsigned char *journal; // registros que todavia no se confirman
+    size_t journal_length;
+    size_t journal_buffer_capacity;
+    size_t journal_used; // bytes del registro en disco desde el ultimo índice completo
+    Extent *pending; // bloques liberados que el índice confirmado todavia usa, se sueltan al confirmar
+    size_t num_pending;
+    size_t pending_capacity;
+    unsigned char *map; // proyección de solo lectura del archivo, se crea si copy_file_range no sirve
+    size_t map_length;
+    pthread_mutex_t map_lock;
+    atomic_bool copy_file_range_ok; // se apaga la primera vez que el sistema de archivos lo rechaza
+    IoEngine io; // escrituras en vuelo de ingest_files; fuera de ahí es síncrono
+    int direct_fd; // el mismo archivo abierto con O_DIRECT (--direct), -1 si no
+} Archive;
+
+
+
+void *xrealloc(void *ptr, size_t size) {
+    void *new_ptr = realloc(ptr, size);
+    if (new_ptr == NULL && size > 0) {
+        fprintf(stderr, "Error: memoria insuficiente\n");
+        exit(1);
+    }
+    return new_ptr;
+}
+
+// pool de buffers alineados a IO_DIRECT_ALIGN, compartido por todos los hilos y todas las operaciones: los
+// buffers de bloques, trozos y tareas se piden y se devuelven aquí en vez de malloc/free en cada uno
+#define POOL_CLASSES 16 // de 4 KB a 128 MB en potencias de 2; lo más grande no se guarda
+#define POOL_MAX_CACHED (256 * 1024 * 1024) // bytes libres que se guardan para reusar, lo que pasa se libera
+
+typedef struct {
+    void *free_lists[POOL_CLASSES]; // el primer puntero de cada buffer libre apunta al siguiente
+    size_t cached; // bytes en las listas
+    pthread_mutex_t lock;
+} BufferPool;
+
+BufferPool buffer_pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+unsigned pool_class(size_t size) {
+    unsigned c = 0;
+    while (c < POOL_CLASSES && ((size_t)IO_DIRECT_ALIGN << c) < size) c++;
+    return c;
+}
+
+void *buffer_get(size_t size) {
+    // al menos size bytes; el contenido es el que dejó el uso anterior
+    unsigned c = pool_class(size);
+    size_t capacity = c < POOL_CLASSES ? (size_t)IO_DIRECT_ALIGN << c : size;
+    void *buffer = NULL;
+    if (c < POOL_CLASSES) {
+        pthread_mutex_lock(&buffer_pool.lock);
+        buffer = buffer_pool.free_lists[c];
+        if (buffer != NULL) {
+            buffer_pool.free_lists[c] = *(void **)buffer;
+            buffer_pool.cached -= capacity;
+        }
+        pthread_mutex_unlock(&buffer_pool.lock);
+    }
+    if (buffer == NULL && posix_memalign(&buffer, IO_DIRECT_ALIGN, capacity) != 0) {
+        fprintf(stderr, "Error: memoria insuficiente\n");
+        exit(1);
+    }
+    return buffer;
+}
+
+void buffer_put(void *buffer, size_t size) {
+    // size es el mismo que se pidió; NULL no hace nada
+    if (buffer == NULL) return;
+    unsigned c = pool_class(size);
+    if (c < POOL_CLASSES) {
+        size_t capacity = (size_t)IO_DIRECT_ALIGN << c;
+        pthread_mutex_lock(&buffer_pool.lock);
+        bool keep = buffer_pool.cached + capacity <= POOL_MAX_CACHED;
+        if (keep) {
+            *(void **)buffer = buffer_pool.free_lists[c];
+            buffer_pool.free_lists[c] = buffer;
+            buffer_pool.cached += capacity;
+        }
+        pthread_mutex_unlock(&buffer_pool.lock);
+        if (keep) return;
+    }
+    free(buffer);
+}
+
+// instrumentación de --stats: los contadores son atómicos y siempre están, los tiempos solo se toman si se
+// pidieron. Los tiempos de E/S se suman entre hilos, con -j pueden pasar el tiempo total.
+typedef struct {
+    bool enabled;
+    uint64_t start;
+    atomic_uint_fast64_t bytes_read;
+    atomic_uint_fast64_t bytes_written;
+    atomic_uint_fast64_t reads; // llamadas al sistema
+    atomic_uint_fast64_t writes;
+    atomic_uint_fast64_t seeks; // accesos que no siguen donde terminó el anterior del mismo hilo, y lseek
+    atomic_uint_fast64_t truncates; // ftruncate y fallocate, incluidos los huecos perforados
+    atomic_uint_fast64_t syncs;
+    atomic_uint_fast64_t data_io_ns;
+    atomic_uint_fast64_t index_io_ns;
+    atomic_uint_fast64_t index_ns; // cargar y guardar el índice y el registro, con su E/S
+    atomic_uint_fast64_t alloc_ns;
+    size_t members; // del ultimo archivo empacado que se cerró, para la fragmentación
+    size_t extents;
+    size_t free_extents;
+} Stats;
+
+Stats stats;
+_Thread_local int stats_index_depth; // dentro de una sección del índice la E/S se cuenta como del índice
+_Thread_local int stats_last_fd = -1;
+_Thread_local size_t stats_last_end;
+
+uint64_t stats_now(void) {
+    if (!stats.enabled) return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_count(atomic_uint_fast64_t *counter, uint64_t amount) {
+    atomic_fetch_add_explicit(counter, amount, memory_order_relaxed);
+}
+
+void stats_io(int fd, size_t offset, size_t length, bool write, uint64_t start) {
+    // una llamada al sistema ya hecha; offset es (size_t)-1 para las que no tienen posición
+    stats_count(write ? &stats.bytes_written : &stats.bytes_read, length);
+    stats_count(write ? &stats.writes : &stats.reads, 1);
+    if (offset != (size_t)-1) {
+        if (fd != stats_last_fd || offset != stats_last_end) stats_count(&stats.seeks, 1);
+        stats_last_fd = fd;
+        stats_last_end = offset + length;
+    }
+    if (start != 0) stats_count(stats_index_depth > 0 ? &stats.index_io_ns : &stats.data_io_ns, stats_now() - start);
+}
+
+uint64_t stats_index_begin(void) {
+    stats_index_depth++;
+    return stats_now();
+}
+
+void stats_index_end(uint64_t start) {
+    // las secciones anidadas (write_fat dentro de journal_commit) se cuentan una sola vez
+    if (--stats_index_depth == 0 && start != 0) stats_count(&stats.index_ns, stats_now() - start);
+}
+
+void star_stats_enable(void) {
+    stats.enabled = true;
+    stats.start = stats_now();
+}
+
+void star_stats_report(bool json) {
+    // a stderr: con -O la salida estándar lleva datos
+    double seconds = (stats_now() - stats.start) / 1e9;
+    double fragmentation = stats.members > 0 ? (double)stats.extents / stats.members : 0;
+    unsigned long long v[] = {atomic_load(&stats.bytes_read), atomic_load(&stats.reads), atomic_load(&stats.bytes_written), atomic_load(&stats.writes),
+                              atomic_load(&stats.seeks), atomic_load(&stats.truncates), atomic_load(&stats.syncs)};
+    double t[] = {atomic_load(&stats.data_io_ns) / 1e9, atomic_load(&stats.index_ns) / 1e9, atomic_load(&stats.index_io_ns) / 1e9,
+                  atomic_load(&stats.alloc_ns) / 1e9};
+    if (json) {
+        fprintf(stderr, "{\"seconds\":%.6f,\"bytes_read\":%llu,\"read_calls\":%llu,\"bytes_written\":%llu,\"write_calls\":%llu,"
+                        "\"seeks\":%llu,\"truncates\":%llu,\"syncs\":%llu,\"data_io_seconds\":%.6f,\"index_seconds\":%.6f,"
+                        "\"index_io_seconds\":%.6f,\"alloc_seconds\":%.6f,\"files\":%zu,\"extents\":%zu,\"free_extents\":%zu,"
+                        "\"fragmentation\":%.3f}\n",
+                seconds, v[0], v[1], v[2], v[3], v[4], v[5], v[6], t[0], t[1], t[2], t[3], stats.members, stats.extents, stats.free_extents,
+                fragmentation);
+        return;
+    }
+    fprintf(stderr, "Estadísticas:\n");
+    fprintf(stderr, "  Tiempo total:        %.3f s\n", seconds);
+    fprintf(stderr, "  Leídos:              %llu bytes en %llu llamadas\n", v[0], v[1]);
+    fprintf(stderr, "  Escritos:            %llu bytes en %llu llamadas\n", v[2], v[3]);
+    fprintf(stderr, "  Saltos:              %llu\n", v[4]);
+    fprintf(stderr, "  Truncados/reservas:  %llu\n", v[5]);
+    fprintf(stderr, "  Sincronizaciones:    %llu\n", v[6]);
+    fprintf(stderr, "  E/S de datos:        %.3f s\n", t[0]);
+    fprintf(stderr, "  Índice y registro:   %.3f s (%.3f s de E/S)\n", t[1], t[2]);
+    fprintf(stderr, "  Asignación:          %.3f s\n", t[3]);
+    fprintf(stderr, "  Fragmentación:       %.2f extents por archivo (%zu archivos, %zu extents, %zu huecos libres)\n", fragmentation,
+            stats.members, stats.extents, stats.free_extents);
+}
+
+bool pwrite_all(int fd, const unsigned char *data, size_t length, size_t offset) {
+    while (length > 0) {
+        uint64_t start = stats_now();
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        stats_io(fd, offset, written, true, start);
+        data += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool write_all(int fd, const unsigned char *data, size_t length) {
+    while (length > 0) {
+        uint64_t start = stats_now();
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        stats_io(fd, (size_t)-1, written, true, start);
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+bool pread_all(int fd, unsigned char *data, size_t length, size_t offset) {
+    while (length > 0) {
+        uint64_t start = stats_now();
+        ssize_t n = pread(fd, data, length, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        stats_io(fd, offset, n, false, start);
+        data += n;
+        length -= n;
+        offset += n;
+    }
+    return true;
+}
+
+size_t blocks_for(size_t bytes, size_t block_size) {
+    return (bytes + block_size - 1) / block_size;
+}
+
+size_t blocks_in(size_t bytes, size_t block_size) {
+    // cuantos bloques enteros caben en un trozo de tamaño fijo, al menos uno
+    return bytes > block_size ? bytes / block_size : 1;
+}
+
+// motor de E/S: lecturas y escrituras con posición que quedan en vuelo mientras el hilo sigue trabajando.
+// Con io_uring se mantienen hasta depth pedidos en la cola del kernel; sin io_uring (kernel viejo, deshabilitado
+// o --sync-io) cada pedido se hace en el momento con pread/pwrite y el resto del código no cambia. Un motor es de
+// un solo hilo, y un IoEngine en cero es un motor síncrono valido.
+bool io_use_uring = true; // --sync-io lo apaga, para comparar
+bool io_use_direct = false; // --direct
+
+void star_io_configure(bool uring, bool direct) {
+    io_use_uring = uring;
+    io_use_direct = direct;
+}
+
+int io_uring_enter_call(int ring_fd, unsigned to_submit, unsigned min_complete) {
+    int r;
+    do {
+        r = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (r < 0 && errno == EINTR);
+    return r;
+}
+
+void io_init(IoEngine *io, unsigned depth) {
+    memset(io, 0, sizeof(IoEngine));
+    io->ring_fd = -1;
+    io->direct_source = -1;
+    io->direct_fd = -1;
+    if (!io_use_uring || depth == 0) return;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = syscall(__NR_io_uring_setup, depth, &params);
+    if (ring_fd < 0) return; // ENOSYS, EPERM (deshabilitado), ENOMEM: se queda síncrono
+
+    io->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    io->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && io->cq_ring_size > io->sq_ring_size) io->sq_ring_size = io->cq_ring_size;
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    io->sq_ring = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    io->cq_ring = single ? io->sq_ring : mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (io->sq_ring == MAP_FAILED || io->cq_ring == MAP_FAILED || io->sqes == MAP_FAILED) {
+        if (io->sqes != MAP_FAILED) munmap(io->sqes, io->sqes_size);
+        if (!single && io->cq_ring != MAP_FAILED) munmap(io->cq_ring, io->cq_ring_size);
+        if (io->sq_ring != MAP_FAILED) munmap(io->sq_ring, io->sq_ring_size);
+        close(ring_fd);
+        memset(io, 0, sizeof(IoEngine));
+        io->ring_fd = io->direct_source = io->direct_fd = -1;
+        return;
+    }
+
+    unsigned char *sq = io->sq_ring;
+    unsigned char *cq = io->cq_ring;
+    io->sq_head = (unsigned *)(sq + params.sq_off.head);
+    io->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    io->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    io->sq_array = (unsigned *)(sq + params.sq_off.array);
+    io->cq_head = (unsigned *)(cq + params.cq_off.head);
+    io->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    io->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    io->ring_fd = ring_fd;
+    io->depth = params.sq_entries; // el kernel redondea a potencia de 2
+    io->requests = xrealloc(NULL, io->depth * sizeof(IoRequest));
+    io->free_slots = xrealloc(NULL, io->depth * sizeof(unsigned));
+    for (unsigned i = 0; i < io->depth; i++) io->free_slots[i] = io->depth - 1 - i;
+    io->num_free = io->depth;
+}
+
+void io_register_buffers(IoEngine *io, const struct iovec *buffers, unsigned num_buffers) {
+    // memoria que el kernel deja fijada: se evita mapear las páginas en cada pedido. Si no hay permiso
+    // (RLIMIT_MEMLOCK) los pedidos usan las operaciones comunes
+    if (io->depth == 0 || num_buffers == 0) return;
+    if (syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_BUFFERS, buffers, num_buffers) != 0) return;
+    io->buffers = xrealloc(NULL, num_buffers * sizeof(struct iovec));
+    memcpy(io->buffers, buffers, num_buffers * sizeof(struct iovec));
+    io->num_buffers = num_buffers;
+}
+
+void io_set_direct(IoEngine *io, int fd, int direct_fd) {
+    io->direct_source = direct_fd >= 0 ? fd : -1;
+    io->direct_fd = direct_fd;
+}
+
+int io_target_fd(IoEngine *io, int fd, const unsigned char *data, size_t length, size_t offset) {
+    if (fd != io->direct_source) return fd;
+    bool aligned = ((uintptr_t)data | length | offset) % IO_DIRECT_ALIGN == 0;
+    return aligned ? io->direct_fd : fd;
+}
+
+bool io_finish(int fd, unsigned char *data, size_t length, size_t offset, bool write) {
+    return write ? pwrite_all(fd, data, length, offset) : pread_all(fd, data, length, offset);
+}
+
+void io_complete(IoEngine *io, const struct io_uring_cqe *cqe) {
+    unsigned slot = cqe->user_data;
+    IoRequest *request = &io->requests[slot];
+    bool ok = cqe->res >= 0;
+    if (ok) {
+        size_t done = cqe->res;
+        stats_io(request->fd, request->offset, done, request->write, 0);
+        // una transferencia corta se completa en el momento, como haría pread_all
+        if (done < request->length) ok = done > 0 && io_finish(request->fd, request->data + done, request->length - done, request->offset + done, request->write);
+    } else if (cqe->res == -EINVAL && request->fd != io_target_fd(io, request->fd, request->data, request->length, request->offset)) {
+        ok = io_finish(request->fd, request->data, request->length, request->offset, request->write); // O_DIRECT rechazado
+    } else if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+        ok = io_finish(request->fd, request->data, request->length, request->offset, request->write); // operación que el kernel no tiene
+    }
+    io->free_slots[io->num_free++] = slot;
+    io->in_flight--;
+    if (request->done != NULL) request->done(request->context, ok);
+}
+
+void io_reap(IoEngine *io, bool wait) {
+    // procesar los pedidos terminados; con wait espera al menos uno
+    if (wait && *io->cq_head == __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE)) {
+        uint64_t start = stats_now();
+        if (io_uring_enter_call(io->ring_fd, 0, 1) < 0) {
+            fprintf(stderr, "Error al esperar la E/S: %s\n", strerror(errno));
+            exit(1);
+        }
+        if (start != 0) stats_count(&stats.data_io_ns, stats_now() - start);
+    }
+    for (;;) {
+        // la cabeza se vuelve a leer cada vez: un callback puede encolar y procesar terminados
+        unsigned head = *io->cq_head;
+        if (head == __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE)) break;
+        struct io_uring_cqe cqe = io->cqes[head & *io->cq_mask];
+        __atomic_store_n(io->cq_head, head + 1, __ATOMIC_RELEASE);
+        io_complete(io, &cqe);
+    }
+}
+
+void io_queue(IoEngine *io, int fd, unsigned char *data, size_t length, size_t offset, bool write, IoDone done, void *context) {
+    // sin callback el pedido es síncrono aunque haya io_uring: el que llama reutiliza el buffer enseguida
+    if (io->depth == 0 || done == NULL || length > UINT32_MAX) {
+        int target = io_target_fd(io, fd, data, length, offset);
+        bool ok = io_finish(target, data, length, offset, write);
+        if (!ok && target != fd) ok = io_finish(fd, data, length, offset, write); // O_DIRECT rechazado
+        if (done != NULL) done(context, ok);
+        else if (!ok) {
+            fprintf(stderr, "Error de E/S en la posición %zu\n", offset);
+            exit(1);
+        }
+        return;
+    }
+    while (io->num_free == 0) io_reap(io, true);
+
+    unsigned slot = io->free_slots[--io->num_free];
+    io->requests[slot] = (IoRequest){fd, data, length, offset, write, done, context};
+    unsigned tail = *io->sq_tail;
+    unsigned index = tail & *io->sq_mask;
+    struct io_uring_sqe *sqe = &io->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    for (unsigned b = 0; b < io->num_buffers; b++) {
+        unsigned char *base = io->buffers[b].iov_base;
+        if (data >= base && data + length <= base + io->buffers[b].iov_len) {
+            sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->buf_index = b;
+            break;
+        }
+    }
+    sqe->fd = io_target_fd(io, fd, data, length, offset);
+    sqe->addr = (uintptr_t)data;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = slot;
+    io->sq_array[index] = index;
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io->in_flight++;
+
+    if (io_uring_enter_call(io->ring_fd, 1, 0) < 0) {
+        fprintf(stderr, "Error al enviar la E/S: %s\n", strerror(errno));
+        exit(1);
+    }
+    io_reap(io, false); // lo que ya terminó, sin esperar
+}
+
+void io_write(IoEngine *io, int fd, const unsigned char *data, size_t length, size_t offset, IoDone done, void *context) {
+    io_queue(io, fd, (unsigned char *)data, length, offset, true, done, context);
+}
+
+void io_read(IoEngine *io, int fd, unsigned char *data, size_t length, size_t offset, IoDone done, void *context) {
+    io_queue(io, fd, data, length, offset, false, done, context);
+}
+
+void io_wait(IoEngine *io, unsigned max_in_flight) {
+    // esperar hasta que queden a lo sumo max_in_flight pedidos; io_wait(io, 0) antes de un fdatasync
+    while (io->in_flight > max_in_flight) io_reap(io, true);
+}
+
+void io_free(IoEngine *io) {
+    if (io->depth > 0) {
+        io_wait(io, 0);
+        munmap(io->sqes, io->sqes_size);
+        if (io->cq_ring != io->sq_ring) munmap(io->cq_ring, io->cq_ring_size);
+        munmap(io->sq_ring, io->sq_ring_size);
+        close(io->ring_fd);
+    }
+    free(io->requests);
+    free(io->free_slots);
+    free(io->buffers);
+    memset(io, 0, sizeof(IoEngine));
+    io->ring_fd = io->direct_source = io->direct_fd = -1;
+}
+
+// lote de pedidos: un dueño (un bloque, un trozo) sabe cuando terminaron todos los suyos
+typedef struct IoBatch {
+    unsigned pending; // pedidos sin terminar, más uno mientras el dueño sigue agregando (ver io_batch_release)
+    bool failed;
+    void (*finished)(struct IoBatch *batch); // cuando pending llega a 0, puede ser NULL
+} IoBatch;
+
+void io_batch_done(void *context, bool ok) {
+    IoBatch *batch = context;
+    if (!ok) batch->failed = true;
+    if (--batch->pending == 0 && batch->finished != NULL) batch->finished(batch);
+}
+
+void io_batch_release(IoBatch *batch) {
+    io_batch_done(batch, true);
+}
+
+void io_batch_write(IoEngine *io, IoBatch *batch, int fd, const unsigned char *data, size_t length, size_t offset) {
+    // sin lote la escritura es síncrona
+    if (batch != NULL) batch->pending++;
+    io_write(io, fd, data, length, offset, batch != NULL ? io_batch_done : NULL, batch);
+}
+
+void io_batch_read(IoEngine *io, IoBatch *batch, int fd, unsigned char *data, size_t length, size_t offset) {
+    if (batch != NULL) batch->pending++;
+    io_read(io, fd, data, length, offset, batch != NULL ? io_batch_done : NULL, batch);
+}
+
+void io_wait_batch(IoEngine *io, IoBatch *batch) {
+    while (batch->pending > 0) io_reap(io, true);
+}
+
+// compresor LZ77 al estilo LZ4: secuencias de (literales, desplazamiento de 16 bits, largo de la coincidencia)
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+size_t lz_put_length(unsigned char *out, size_t op, size_t length) {
+    // largos de 15 o mas se continuan en bytes de 255
+    for (length -= 15; length >= 255; length -= 255) out[op++] = 255;
+    out[op++] = length;
+    return op;
+}
+
+size_t lz_compress(const unsigned char *in, size_t in_length, unsigned char *out, size_t out_capacity) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    size_t ip = 0, anchor = 0, op = 0;
+    size_t limit = in_length > 12 ? in_length - 12 : 0; // los ultimos bytes siempre van como literales
+
+    while (ip < limit) {
+        uint32_t sequence = read32(in + ip);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t ref = table[hash];
+        table[hash] = ip;
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(in + ref) != sequence) {
+            ip++;
+            continue;
+        }
+
+        size_t match = LZ_MIN_MATCH;
+        while (ip + match < in_length && in[ref + match] == in[ip + match]) match++;
+
+        size_t literals = ip - anchor;
+        if (op + 1 + literals + literals / 255 + 2 + match / 255 + 2 > out_capacity) return 0;
+        size_t token = op++;
+        out[token] = (literals >= 15 ? 15 : literals) << 4;
+        if (literals >= 15) op = lz_put_length(out, op, literals);
+        memcpy(out + op, in + anchor, literals);
+        op += literals;
+        out[op++] = (ip - ref) & 0xff;
+        out[op++] = (ip - ref) >> 8;
+        out[token] |= (match - LZ_MIN_MATCH) >= 15 ? 15 : (match - LZ_MIN_MATCH);
+        if (match - LZ_MIN_MATCH >= 15) op = lz_put_length(out, op, match - LZ_MIN_MATCH);
+
+        ip += match;
+        anchor = ip;
+    }
+
+    // secuencia final solo con literales
+    size_t literals = in_length - anchor;
+    if (op + 1 + literals + literals / 255 + 1 > out_capacity) return 0;
+    size_t token = op++;
+    out[token] = (literals >= 15 ? 15 : literals) << 4;
+    if (literals >= 15) op = lz_put_length(out, op, literals);
+    memcpy(out + op, in + anchor, literals);
+    op += literals;
+    return op;
+}
+
+bool lz_get_length(const unsigned char *in, size_t in_length, size_t *ip, size_t *length) {
+    unsigned char byte;
+    do {
+        if (*ip >= in_length) return false;
+        byte = in[(*ip)++];
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool lz_decompress(const unsigned char *in, size_t in_length, unsigned char *out, size_t out_length) {
+    size_t ip = 0, op = 0;
+    while (ip < in_length) {
+        unsigned char token = in[ip++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !lz_get_length(in, in_length, &ip, &literals)) return false;
+        if (ip + literals > in_length || op + literals > out_length) return false;
+        memcpy(out + op, in + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == in_length) break; // la ultima secuencia no tiene coincidencia
+
+        if (ip + 2 > in_length) return false;
+        size_t offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && !lz_get_length(in, in_length, &ip, &match)) return false;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || op + match > out_length) return false;
+        for (size_t i = 0; i < match; i++, op++) out[op] = out[op - offset]; // puede solaparse consigo misma
+    }
+    return op == out_length;
+}
+
+typedef struct {
+    const char *name;
+    size_t (*compress)(const unsigned char *in, size_t in_length, unsigned char *out, size_t out_capacity); // 0 si no conviene
+    bool (*decompress)(const unsigned char *in, size_t in_length, unsigned char *out, size_t out_length);
+} Codec;
+
+const Codec codecs[] = {
+    [CODEC_NONE] = {"none", NULL, NULL},
+    [CODEC_LZ] = {"lz", lz_compress, lz_decompress},
+};
+#define NUM_CODECS (sizeof(codecs) / sizeof(codecs[0]))
+
+int find_codec(const char *name) {
+    for (size_t i = 0; i < NUM_CODECS; i++) {
+        if (strcmp(codecs[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+int compare_extents(const void *a, const void *b) {
+    size_t x = ((const Extent *)a)->position;
+    size_t y = ((const Extent *)b)->position;
+    return (x > y) - (x < y);
+}
+
+void allocator_free(Allocator *alloc, size_t position, size_t num_blocks) {
+    if (num_blocks == 0) return;
+
+    // busqueda binaria del primer extent que empieza despues de la posicion liberada
+    size_t lo = 0, hi = alloc->num_extents;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (alloc->extents[mid].position < position) lo = mid + 1;
+        else hi = mid;
+    }
+
+    size_t end = position + num_blocks * alloc->block_size;
+    bool joins_prev = lo > 0 && alloc->extents[lo - 1].position + alloc->extents[lo - 1].num_blocks * alloc->block_size == position;
+    bool joins_next = lo < alloc->num_extents && alloc->extents[lo].position == end;
+
+    if (joins_prev && joins_next) {
+        // el rango liberado une dos extents vecinos
+        alloc->extents[lo - 1].num_blocks += num_blocks + alloc->extents[lo].num_blocks;
+        memmove(&alloc->extents[lo], &alloc->extents[lo + 1], (alloc->num_extents - lo - 1) * sizeof(Extent));
+        alloc->num_extents--;
+    } else if (joins_prev) {
+        alloc->extents[lo - 1].num_blocks += num_blocks;
+    } else if (joins_next) {
+        alloc->extents[lo].position = position;
+        alloc->extents[lo].num_blocks += num_blocks;
+    } else {
+        if (alloc->num_extents == alloc->capacity) {
+            alloc->capacity = alloc->capacity ? alloc->capacity * 2 : 16;
+            alloc->extents = xrealloc(alloc->extents, alloc->capacity * sizeof(Extent));
+        }
+        memmove(&alloc->extents[lo + 1], &alloc->extents[lo], (alloc->num_extents - lo) * sizeof(Extent));
+        alloc->extents[lo].position = position;
+        alloc->extents[lo].num_blocks = num_blocks;
+        alloc->num_extents++;
+    }
+}
+
+void allocator_build(Allocator *alloc, Archive *ar, size_t file_size) {
+    memset(alloc, 0, sizeof(Allocator));
+    alloc->block_size = ar->sb.block_size;
+
+    size_t data_start = ar->sb.data_start;
+    if (file_size < data_start) file_size = data_start;
+    alloc->archive_end = data_start + blocks_for(file_size - data_start, alloc->block_size) * alloc->block_size;
+
+    // NOTA: los bloques libres no se guardan en el archivo, son los huecos entre los extents usados
+    size_t num_used = 2; // índice y registro de cambios
+    for (size_t i = 0; i < ar->fat.num_files; i++) num_used += ar->fat.files[i].num_extents;
+
+    Extent *used = xrealloc(NULL, num_used * sizeof(Extent));
+    size_t count = 0;
+    if (ar->sb.index_length > 0) {
+        used[count].position = ar->sb.index_offset;
+        used[count++].num_blocks = blocks_for(ar->sb.index_length, alloc->block_size);
+    }
+    if (ar->sb.journal_offset != 0) {
+        // el registro empieza dentro del ultimo bloque del índice
+        used[count].position = data_start + (ar->sb.journal_offset - data_start) / alloc->block_size * alloc->block_size;
+        used[count].num_blocks = blocks_for(ar->sb.journal_offset + ar->sb.journal_capacity - used[count].position, alloc->block_size);
+        count++;
+    }
+    for (size_t i = 0; i < ar->fat.num_files; i++) {
+        for (size_t j = 0; j < ar->fat.files[i].num_extents; j++) used[count++] = ar->fat.files[i].extents[j];
+    }
+    qsort(used, count, sizeof(Extent), compare_extents);
+
+    size_t cursor = data_start;
+    for (size_t i = 0; i < count; i++) {
+        if (used[i].position > cursor) allocator_free(alloc, cursor, (used[i].position - cursor) / alloc->block_size);
+        size_t end = used[i].position + used[i].num_blocks * alloc->block_size;
+        if (end > cursor) cursor = end;
+    }
+    if (cursor > alloc->archive_end) alloc->archive_end = cursor;
+    if (cursor < alloc->archive_end) allocator_free(alloc, cursor, (alloc->archive_end - cursor) / alloc->block_size);
+
+    free(used);
+}
+
+void allocator_grow(Allocator *alloc, FILE *archive, size_t num_blocks) {
+    size_t current_size = alloc->archive_end;
+    size_t expanded_size = current_size + num_blocks * alloc->block_size;
+    stats_count(&stats.truncates, 1);
+
+    // reservar todo el trozo de una vez, si el sistema de archivos no soporta fallocate se usa ftruncate
+    if (posix_fallocate(fileno(archive), current_size, expanded_size - current_size) != 0) {
+        if (ftruncate(fileno(archive), expanded_size) != 0) {
+            fprintf(stderr, "Error al expandir el archivo empacado\n");
+            exit(1);
+        }
+    }
+
+    alloc->archive_end = expanded_size;
+    allocator_free(alloc, current_size, num_blocks); // meter el trozo nuevo a la lista de extents libres
+}
+
+size_t allocator_take_from(Allocator *alloc, size_t i, size_t num_blocks) {
+    // tomar los primeros bloques del extent libre i
+    Extent *extent = &alloc->extents[i];
+    size_t position = extent->position;
+    extent->position += num_blocks * alloc->block_size;
+    extent->num_blocks -= num_blocks;
+    if (extent->num_blocks == 0) {
+        memmove(extent, extent + 1, (alloc->num_extents - i - 1) * sizeof(Extent));
+        alloc->num_extents--;
+    }
+    return position;
+}
+
+size_t allocator_take(Allocator *alloc, size_t num_blocks) {
+    // primer extent donde quepa la corrida completa, asi el archivo queda contiguo
+    for (size_t i = 0; i < alloc->num_extents; i++) {
+        if (alloc->extents[i].num_blocks >= num_blocks) return allocator_take_from(alloc, i, num_blocks);
+    }
+    return (size_t)-1; // no hay hueco suficiente
+}
+
+size_t allocator_hole_before(Allocator *alloc, size_t position) {
+    // extent libre que termina justo en position, o -1
+    size_t lo = 0, hi = alloc->num_extents;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (alloc->extents[mid].position < position) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo > 0 && alloc->extents[lo - 1].position + alloc->extents[lo - 1].num_blocks * alloc->block_size == position) return lo - 1;
+    return (size_t)-1;
+}
+
+size_t allocator_extend(Allocator *alloc, FILE *archive, size_t num_blocks) {
+    // no cabe en ningun hueco: crecer el final del archivo (aprovechando el ultimo extent si llega hasta el final)
+    size_t missing = num_blocks;
+    if (alloc->num_extents > 0) {
+        Extent *last = &alloc->extents[alloc->num_extents - 1];
+        if (last->position + last->num_blocks * alloc->block_size == alloc->archive_end) missing -= last->num_blocks;
+    }
+    size_t chunk = blocks_in(GROWTH_CHUNK_SIZE, alloc->block_size);
+    allocator_grow(alloc, archive, missing > chunk ? missing : chunk);
+    return allocator_take(alloc, num_blocks);
+}
+
+size_t allocator_alloc(Allocator *alloc, FILE *archive, size_t num_blocks) {
+    uint64_t start = stats_now();
+    size_t position = allocator_take(alloc, num_blocks);
+    if (position == (size_t)-1) position = allocator_extend(alloc, archive, num_blocks);
+    if (start != 0) stats_count(&stats.alloc_ns, stats_now() - start);
+    return position;
+}
+
+void allocator_trim(Allocator *alloc) {
+    // olvidar la reserva que quedo sin usar al final del archivo
+    if (alloc->num_extents > 0) {
+        Extent *last = &alloc->extents[alloc->num_extents - 1];
+        if (last->position + last->num_blocks * alloc->block_size == alloc->archive_end) {
+            alloc->archive_end = last->position;
+            alloc->num_extents--;
+        }
+    }
+}
+
+uint64_t checksum64(const void *data, size_t length) {
+    // FNV-1a de 64 bits sobre bytes
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = data; length > 0; p++, length--) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// XXH64: cuatro acumuladores independientes sobre franjas de 32 bytes, el compilador los vectoriza
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3 0x165667B19E3779F9ULL
+#define HASH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME5 0x27D4EB2F165667C5ULL
+
+uint64_t read64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t hash_round(uint64_t acc, uint64_t input) {
+    return rotl64(acc + input * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+uint64_t hash_merge(uint64_t acc, uint64_t value) {
+    return (acc ^ hash_round(0, value)) * HASH_PRIME1 + HASH_PRIME4;
+}
+
+uint64_t hash_block(const unsigned char *data, size_t length) {
+    const unsigned char *p = data;
+    const unsigned char *end = data + length;
+    uint64_t h;
+    if (length >= 32) {
+        uint64_t v1 = HASH_PRIME1 + HASH_PRIME2, v2 = HASH_PRIME2, v3 = 0, v4 = -HASH_PRIME1;
+        for (; end - p >= 32; p += 32) {
+            v1 = hash_round(v1, read64(p));
+            v2 = hash_round(v2, read64(p + 8));
+            v3 = hash_round(v3, read64(p + 16));
+            v4 = hash_round(v4, read64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = hash_merge(hash_merge(hash_merge(hash_merge(h, v1), v2), v3), v4);
+    } else {
+        h = HASH_PRIME5;
+    }
+    h += length;
+    for (; end - p >= 8; p += 8) h = rotl64(h ^ hash_round(0, read64(p)), 27) * HASH_PRIME1 + HASH_PRIME4;
+    if (end - p >= 4) {
+        h = rotl64(h ^ read32(p) * HASH_PRIME1, 23) * HASH_PRIME2 + HASH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) h = rotl64(h ^ *p * HASH_PRIME5, 11) * HASH_PRIME1;
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    return h ^ (h >> 32);
+}
+
+#define BUCKET_EMPTY 0
+#define BUCKET_DELETED ((size_t)-1)
+
+uint64_t hash_name(const char *name) {
+    // FNV-1a de 64 bits
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void fat_index_insert(FAT *fat, size_t file_index) {
+    size_t mask = fat->num_buckets - 1;
+    size_t slot = hash_name(fat->files[file_index].filename) & mask;
+    while (fat->buckets[slot] != BUCKET_EMPTY && fat->buckets[slot] != BUCKET_DELETED) slot = (slot + 1) & mask;
+    if (fat->buckets[slot] == BUCKET_EMPTY) fat->num_used_buckets++;
+    fat->buckets[slot] = file_index + 1;
+}
+
+void fat_rehash(FAT *fat, size_t num_buckets) {
+    free(fat->buckets);
+    fat->buckets = calloc(num_buckets, sizeof(size_t));
+    if (fat->buckets == NULL) {
+        fprintf(stderr, "Error: memoria insuficiente\n");
+        exit(1);
+    }
+    fat->num_buckets = num_buckets;
+    fat->num_used_buckets = 0;
+    for (size_t i = 0; i < fat->num_files; i++) {
+        if (!fat->files[i].deleted) fat_index_insert(fat, i);
+    }
+}
+
+size_t fat_find_slot(FAT *fat, const char *filename) {
+    if (fat->num_buckets == 0) return BUCKET_DELETED;
+    size_t mask = fat->num_buckets - 1;
+    size_t slot = hash_name(filename) & mask;
+    while (fat->buckets[slot] != BUCKET_EMPTY) {
+        size_t value = fat->buckets[slot];
+        if (value != BUCKET_DELETED && strcmp(fat->files[value - 1].filename, filename) == 0) return slot;
+        slot = (slot + 1) & mask;
+    }
+    return BUCKET_DELETED; // no esta
+}
+
+FileEntry *fat_find(FAT *fat, const char *filename) {
+    size_t slot = fat_find_slot(fat, filename);
+    return slot == BUCKET_DELETED ? NULL : &fat->files[fat->buckets[slot] - 1];
+}
+
+FileEntry *fat_add(FAT *fat, const char *filename) {
+    if (fat->num_files == fat->capacity) {
+        fat->capacity = fat->capacity ? fat->capacity * 2 : 64;
+        fat->files = xrealloc(fat->files, fat->capacity * sizeof(FileEntry));
+    }
+    FileEntry *entry = &fat->files[fat->num_files++];
+    memset(entry, 0, sizeof(FileEntry));
+    entry->filename = strdup(filename);
+
+    // mantener la tabla a menos de la mitad de carga (contando lapidas)
+    if ((fat->num_used_buckets + 1) * 2 > fat->num_buckets) {
+        size_t num_buckets = fat->num_buckets ? fat->num_buckets : 128;
+        while ((fat->num_files - fat->num_deleted + 1) * 4 > num_buckets) num_buckets *= 2;
+        fat_rehash(fat, num_buckets);
+    } else {
+        fat_index_insert(fat, fat->num_files - 1);
+    }
+    return entry;
+}
+
+void fat_remove(FAT *fat, FileEntry *entry) {
+    // O(1): se deja una lapida en la tabla y en el arreglo, el índice se compacta al escribirse
+    size_t slot = fat_find_slot(fat, entry->filename);
+    if (slot != BUCKET_DELETED) fat->buckets[slot] = BUCKET_DELETED;
+    free(entry->extents);
+    free(entry->frames);
+    free(entry->frame_offsets);
+    entry->extents = NULL;
+    entry->frames = NULL;
+    entry->frame_offsets = NULL;
+    entry->num_frames = entry->frames_capacity = 0;
+    free(entry->hashes);
+    entry->hashes = NULL;
+    entry->num_hashes = entry->hashes_capacity = 0;
+    entry->num_extents = entry->extents_capacity = entry->num_blocks = 0;
+    entry->deleted = true;
+    fat->num_deleted++;
+}
+
+FileEntry *fat_find_or_add(FAT *fat, const char *filename) {
+    FileEntry *entry = fat_find(fat, filename);
+    return entry != NULL ? entry : fat_add(fat, filename);
+}
+
+void entry_add_blocks(FileEntry *entry, size_t position, size_t num_blocks, size_t block_size) {
+    // si el bloque sigue al ultimo extent se alarga la corrida en vez de crear otra
+    if (entry->num_extents > 0) {
+        Extent *last = &entry->extents[entry->num_extents - 1];
+        if (last->position + last->num_blocks * block_size == position) {
+            last->num_blocks += num_blocks;
+            entry->num_blocks += num_blocks;
+            return;
+        }
+    }
+    if (entry->num_extents == entry->extents_capacity) {
+        entry->extents_capacity = entry->extents_capacity ? entry->extents_capacity * 2 : 4;
+        entry->extents = xrealloc(entry->extents, entry->extents_capacity * sizeof(Extent));
+    }
+    entry->extents[entry->num_extents].position = position;
+    entry->extents[entry->num_extents].num_blocks = num_blocks;
+    entry->num_extents++;
+    entry->num_blocks += num_blocks;
+}
+
+bool entry_remap(FileEntry *entry, size_t source, size_t target, size_t num_blocks, size_t block_size) {
+    // los bloques [source, source + num_blocks) se movieron a target: partir los extents que los tocan
+    size_t end = source + num_blocks * block_size;
+    bool found = false;
+    for (size_t j = 0; j < entry->num_extents && !found; j++) {
+        found = entry->extents[j].position < end && entry->extents[j].position + entry->extents[j].num_blocks * block_size > source;
+    }
+    if (!found) return false;
+
+    Extent *extents = entry->extents;
+    size_t num_extents = entry->num_extents;
+    entry->extents = NULL;
+    entry->num_extents = entry->extents_capacity = entry->num_blocks = 0;
+    for (size_t k = 0; k < num_extents; k++) {
+        size_t position = extents[k].position;
+        size_t extent_end = position + extents[k].num_blocks * block_size;
+        if (position >= end || extent_end <= source) {
+            entry_add_blocks(entry, position, extents[k].num_blocks, block_size);
+            continue;
+        }
+        size_t low = position > source ? position : source;
+        size_t high = extent_end < end ? extent_end : end;
+        if (low > position) entry_add_blocks(entry, position, (low - position) / block_size, block_size);
+        entry_add_blocks(entry, target + (low - source), (high - low) / block_size, block_size);
+        if (high < extent_end) entry_add_blocks(entry, high, (extent_end - high) / block_size, block_size);
+    }
+    free(extents);
+    return true;
+}
+
+void entry_add_hash(FileEntry *entry, uint64_t hash) {
+    if (entry->num_hashes == entry->hashes_capacity) {
+        entry->hashes_capacity = entry->hashes_capacity ? entry->hashes_capacity * 2 : 16;
+        entry->hashes = xrealloc(entry->hashes, entry->hashes_capacity * sizeof(uint64_t));
+    }
+    entry->hashes[entry->num_hashes++] = hash;
+}
+
+void entry_add_frame(FileEntry *entry, uint32_t frame) {
+    if (entry->num_frames + 1 >= entry->frames_capacity) {
+        entry->frames_capacity = entry->frames_capacity ? entry->frames_capacity * 2 : 16;
+        entry->frames = xrealloc(entry->frames, entry->frames_capacity * sizeof(uint32_t));
+        entry->frame_offsets = xrealloc(entry->frame_offsets, entry->frames_capacity * sizeof(uint64_t));
+    }
+    if (entry->num_frames == 0) entry->frame_offsets[0] = 0;
+    entry->frames[entry->num_frames] = frame;
+    entry->frame_offsets[entry->num_frames + 1] = entry->frame_offsets[entry->num_frames] + (frame & FRAME_SIZE_MASK);
+    entry->num_frames++;
+}
+
+size_t slab_find(Archive *ar, size_t position) {
+    // busqueda binaria, devuelve donde estaria el bloque si no esta
+    size_t lo = 0, hi = ar->num_slabs;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (ar->slabs[mid].position < position) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+Slab *slab_insert(Archive *ar, size_t position) {
+    size_t i = slab_find(ar, position);
+    if (i < ar->num_slabs && ar->slabs[i].position == position) return &ar->slabs[i];
+    if (ar->num_slabs == ar->slabs_capacity) {
+        ar->slabs_capacity = ar->slabs_capacity ? ar->slabs_capacity * 2 : 16;
+        ar->slabs = xrealloc(ar->slabs, ar->slabs_capacity * sizeof(Slab));
+    }
+    memmove(&ar->slabs[i + 1], &ar->slabs[i], (ar->num_slabs - i) * sizeof(Slab));
+    ar->num_slabs++;
+    memset(&ar->slabs[i], 0, sizeof(Slab));
+    ar->slabs[i].position = position;
+    return &ar->slabs[i];
+}
+
+void slabs_build(Archive *ar) {
+    // los bloques compartidos no se guardan aparte, se reconstruyen con los archivos empaquetados
+    for (size_t i = 0; i < ar->fat.num_files; i++) {
+        FileEntry *entry = &ar->fat.files[i];
+        if (entry->deleted || !entry->packed || entry->num_extents == 0) continue;
+        Slab *slab = slab_insert(ar, entry->extents[0].position);
+        size_t end = entry->data_offset + (entry->num_frames > 0 ? entry->frame_offsets[entry->num_frames] : entry->file_size);
+        if (end > slab->used) slab->used = end;
+        slab->live_members++;
+    }
+}
+
+size_t slab_place(Archive *ar, size_t length) {
+    // primer bloque compartido al que le quede espacio al final, o uno nuevo
+    for (size_t i = 0; i < ar->num_slabs; i++) {
+        if (ar->sb.block_size - ar->slabs[i].used >= length) return i;
+    }
+    Slab *slab = slab_insert(ar, allocator_alloc(&ar->alloc, ar->file, 1));
+    return slab - ar->slabs;
+}
+
+void archive_release(Archive *ar, size_t position, size_t num_blocks) {
+    // no se pueden reusar hasta que el cambio que los libera esté confirmado en el registro
+    if (ar->num_pending == ar->pending_capacity) {
+        ar->pending_capacity = ar->pending_capacity ? ar->pending_capacity * 2 : 16;
+        ar->pending = xrealloc(ar->pending, ar->pending_capacity * sizeof(Extent));
+    }
+    ar->pending[ar->num_pending].position = position;
+    ar->pending[ar->num_pending++].num_blocks = num_blocks;
+}
+
+size_t block_table_slot(BlockTable *table, uint64_t key) {
+    size_t mask = table->num_slots - 1;
+    size_t slot = (key * HASH_PRIME1) >> 17 & mask;
+    while (table->slots[slot].used && table->slots[slot].key != key) slot = (slot + 1) & mask;
+    return slot;
+}
+
+BlockSlot *block_table_find(BlockTable *table, uint64_t key) {
+    if (table->num_slots == 0) return NULL;
+    BlockSlot *slot = &table->slots[block_table_slot(table, key)];
+    return slot->used ? slot : NULL;
+}
+
+BlockSlot *block_table_insert(BlockTable *table, uint64_t key) {
+    // crece a menos de la mitad de carga; puede mover las entradas
+    if ((table->count + 1) * 2 > table->num_slots) {
+        BlockTable grown = {calloc(table->num_slots ? table->num_slots * 2 : 1024, sizeof(BlockSlot)), table->num_slots ? table->num_slots * 2 : 1024, table->count};
+        if (grown.slots == NULL) {
+            fprintf(stderr, "Error: memoria insuficiente\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < table->num_slots; i++) {
+            if (table->slots[i].used) grown.slots[block_table_slot(&grown, table->slots[i].key)] = table->slots[i];
+        }
+        free(table->slots);
+        *table = grown;
+    }
+    BlockSlot *slot = &table->slots[block_table_slot(table, key)];
+    if (!slot->used) {
+        memset(slot, 0, sizeof(BlockSlot));
+        slot->used = true;
+        slot->key = key;
+        table->count++;
+    }
+    return slot;
+}
+
+bool blocks_tracked(Archive *ar, FileEntry *entry) {
+    // solo los bloques sin comprimir ni empaquetar de archivos con hashes pueden ser compartidos
+    return (ar->sb.flags & SB_DEDUP) && !entry->packed && entry->codec == CODEC_NONE && entry->num_hashes > 0;
+}
+
+void block_add(Archive *ar, size_t position, uint64_t hash) {
+    // un bloque recien escrito, con una referencia
+    BlockSlot *slot = block_table_insert(&ar->block_refs, position);
+    slot->value = hash;
+    slot->refs++;
+    block_table_insert(&ar->block_hashes, hash)->value = position;
+}
+
+void block_unref(Archive *ar, size_t position) {
+    BlockSlot *slot = block_table_find(&ar->block_refs, position);
+    if (slot != NULL && slot->refs > 1) {
+        slot->refs--;
+        return;
+    }
+    if (slot != NULL) slot->refs = 0;
+    archive_release(ar, position, 1);
+}
+
+bool extent_shared(Archive *ar, size_t position, size_t num_blocks) {
+    for (size_t k = 0; k < num_blocks && ar->block_refs.num_slots > 0; k++) {
+        BlockSlot *slot = block_table_find(&ar->block_refs, position + k * ar->sb.block_size);
+        if (slot != NULL && slot->refs > 1) return true;
+    }
+    return false;
+}
+
+void blocks_build(Archive *ar) {
+    // las referencias no se guardan en el archivo, se cuentan a partir de los extents y hashes del índice
+    size_t block_size = ar->sb.block_size;
+    for (size_t i = 0; i < ar->fat.num_files; i++) {
+        FileEntry *entry = &ar->fat.files[i];
+        if (entry->deleted || !blocks_tracked(ar, entry)) continue;
+        size_t block = 0;
+        for (size_t j = 0; j < entry->num_extents; j++) {
+            for (size_t k = 0; k < entry->extents[j].num_blocks && block < entry->num_hashes; k++, block++) {
+                while (block < entry->num_frames && entry->frames[block] == FRAME_HOLE) block++; // los huecos no tienen bloque
+                if (block == entry->num_hashes) break;
+                block_add(ar, entry->extents[j].position + k * block_size, entry->hashes[block]);
+            }
+        }
+    }
+}
+
+void blocks_move(Archive *ar, size_t source, size_t target, size_t num_blocks) {
+    // el bloque cambia de posición con todas sus referencias: defrag_units agrupa a todos los archivos que
+    // lo comparten y se remapean juntos
+    for (size_t k = 0; k < num_blocks && ar->block_refs.num_slots > 0; k++) {
+        size_t from = source + k * ar->sb.block_size;
+        size_t to = target + k * ar->sb.block_size;
+        BlockSlot *slot = block_table_find(&ar->block_refs, from);
+        if (slot == NULL || slot->refs == 0) continue;
+        uint64_t hash = slot->value;
+        uint32_t refs = slot->refs;
+        slot->refs = 0;
+        slot = block_table_insert(&ar->block_refs, to); // puede mover las entradas
+        slot->value = hash;
+        slot->refs = refs;
+        BlockSlot *candidate = block_table_find(&ar->block_hashes, hash);
+        if (candidate == NULL || candidate->value == from) block_table_insert(&ar->block_hashes, hash)->value = to;
+    }
+}
+
+size_t dedup_find(Archive *ar, const unsigned char *data, size_t length, uint64_t hash) {
+    // bloque ya guardado con el mismo contenido, o -1. Se compara byte a byte: un hash igual casi siempre es el
+    // mismo bloque, pero la entrada de la tabla puede ser vieja o el hash puede coincidir por azar
+    BlockSlot *candidate = block_table_find(&ar->block_hashes, hash);
+    if (candidate == NULL) return (size_t)-1;
+    size_t position = candidate->value;
+    BlockSlot *block = block_table_find(&ar->block_refs, position);
+    if (block == NULL || block->refs == 0) return (size_t)-1;
+    if (ar->dedup_buffer == NULL) ar->dedup_buffer = buffer_get(ar->sb.block_size);
+    io_wait(&ar->io, 0); // el candidato puede ser un bloque que todavia se está escribiendo
+    if (!pread_all(fileno(ar->file), ar->dedup_buffer, length, position) || memcmp(ar->dedup_buffer, data, length) != 0) return (size_t)-1;
+    block->refs++;
+    ar->dedup_blocks++;
+    return position;
+}
+
+void dedup_enable(Archive *ar) {
+    // a partir de aqui el archivo cuenta referencias; el indicador tiene que llegar al disco antes que el
+    // primer bloque compartido, asi que el siguiente guardado es un índice completo
+    ar->dedup = true;
+    if (ar->sb.flags & SB_DEDUP) return;
+    ar->sb.flags |= SB_DEDUP;
+    ar->needs_checkpoint = true;
+    blocks_build(ar);
+}
+
+EntryMetadata metadata_from_stat(const struct stat *st) {
+    return (EntryMetadata){st->st_mode, st->st_uid, st->st_gid, st->st_mtim.tv_nsec, st->st_mtim.tv_sec};
+}
+
+void superblock_require(Archive *ar, uint32_t flag) {
+    // como con la deduplicación, el indicador llega al disco con un índice completo antes que el primer registro que lo usa
+    if (ar->sb.flags & flag) return;
+    ar->sb.flags |= flag;
+    ar->needs_checkpoint = true;
+}
+
+void entry_set_metadata(Archive *ar, FileEntry *entry, const EntryMetadata *metadata) {
+    entry->metadata = *metadata;
+    if (metadata->mode != 0) superblock_require(ar, SB_METADATA);
+}
+
+void entry_reset(FileEntry *entry) {
+    entry->num_extents = 0;
+    entry->num_blocks = 0;
+    entry->file_size = 0;
+    entry->codec = CODEC_NONE;
+    entry->num_frames = 0;
+    entry->num_hashes = 0;
+    entry->packed = false;
+    entry->data_offset = 0;
+    memset(&entry->metadata, 0, sizeof(EntryMetadata));
+}
+
+void entry_release_blocks(Archive *ar, FileEntry *entry) {
+    if (entry->packed && entry->num_extents > 0) {
+        // el bloque compartido solo se libera cuando ya no le quedan archivos
+        size_t i = slab_find(ar, entry->extents[0].position);
+        if (i < ar->num_slabs && ar->slabs[i].position == entry->extents[0].position && --ar->slabs[i].live_members == 0) {
+            archive_release(ar, ar->slabs[i].position, 1);
+            memmove(&ar->slabs[i], &ar->slabs[i + 1], (ar->num_slabs - i - 1) * sizeof(Slab));
+            ar->num_slabs--;
+        }
+    } else if (blocks_tracked(ar, entry)) {
+        for (size_t k = 0; k < entry->num_extents; k++) {
+            for (size_t b = 0; b < entry->extents[k].num_blocks; b++) block_unref(ar, entry->extents[k].position + b * ar->sb.block_size);
+        }
+    } else {
+        for (size_t k = 0; k < entry->num_extents; k++) {
+            archive_release(ar, entry->extents[k].position, entry->extents[k].num_blocks);
+        }
+    }
+    entry_reset(entry);
+}
+
+void fat_clear(FAT *fat) {
+    for (size_t i = 0; i < fat->num_files; i++) {
+        free(fat->files[i].filename);
+        free(fat->files[i].extents);
+        free(fat->files[i].frames);
+        free(fat->files[i].frame_offsets);
+        free(fat->files[i].hashes);
+    }
+    free(fat->files);
+    free(fat->buckets);
+    memset(fat, 0, sizeof(FAT));
+}
+
+bool load_legacy_fat(Archive *ar) {
+    LegacyFAT *legacy = xrealloc(NULL, sizeof(LegacyFAT));
+    fseek(ar->file, 0, SEEK_SET);
+    if (fread(legacy, sizeof(LegacyFAT), 1, ar->file) != 1 || legacy->num_files > LEGACY_MAX_FILES) {
+        free(legacy);
+        return false;
+    }
+
+    memset(&ar->sb, 0, sizeof(Superblock));
+    ar->sb.magic = STAR_MAGIC;
+    ar->sb.version = STAR_VERSION;
+    ar->sb.block_size = LEGACY_BLOCK_SIZE;
+    ar->sb.data_start = sizeof(LegacyFAT); // los bloques del formato antiguo empiezan despues de la FAT fija
+
+    for (size_t i = 0; i < legacy->num_files; i++) {
+        LegacyFileEntry *old = &legacy->files[i];
+        if (old->num_blocks > LEGACY_MAX_BLOCKS_PER_FILE) continue; // entrada corrupta
+        old->filename[LEGACY_MAX_FILENAME_LENGTH - 1] = '\0';
+        FileEntry *entry = fat_add(&ar->fat, old->filename);
+        entry->file_size = old->file_size;
+        for (size_t j = 0; j < old->num_blocks; j++) entry_add_blocks(entry, old->block_positions[j], 1, LEGACY_BLOCK_SIZE);
+    }
+    // NOTA: la lista de bloques libres antigua no se usa, se vuelve a calcular a partir de los extents
+
+    free(legacy);
+    return true;
+}
+
+size_t entry_record_length(FileEntry *entry) {
+    size_t length = sizeof(IndexRecord) + strlen(entry->filename) + entry->num_extents * 2 * sizeof(uint64_t);
+    length += entry->num_frames * sizeof(uint32_t); // solo los comprimidos o con huecos tienen
+    length += entry->num_hashes * sizeof(uint64_t); // los archivos de versiones anteriores no tienen
+    if (entry->packed) length += sizeof(uint32_t);
+    if (entry->metadata.mode != 0) length += sizeof(EntryMetadata);
+    return length;
+}
+
+size_t entry_serialize(FileEntry *entry, unsigned char *buffer) {
+    // registro + nombre + extents (+ tamaños comprimidos, + hashes, + desplazamiento en el bloque compartido, + metadatos)
+    size_t offset = 0;
+    uint32_t flags = entry->codec | (entry->packed ? RECORD_PACKED : 0) | (entry->num_hashes > 0 ? RECORD_HASHES : 0) |
+                     (entry->metadata.mode != 0 ? RECORD_METADATA : 0) | (entry->codec == CODEC_NONE && entry->num_frames > 0 ? RECORD_FRAMES : 0);
+    IndexRecord record = {strlen(entry->filename), flags, entry->file_size, entry->num_extents};
+    memcpy(buffer + offset, &record, sizeof(IndexRecord));
+    offset += sizeof(IndexRecord);
+    memcpy(buffer + offset, entry->filename, record.name_length);
+    offset += record.name_length;
+    for (size_t j = 0; j < entry->num_extents; j++) {
+        uint64_t pair[2] = {entry->extents[j].position, entry->extents[j].num_blocks};
+        memcpy(buffer + offset, pair, sizeof(pair));
+        offset += sizeof(pair);
+    }
+    if (entry->num_frames > 0) { // sin frames ni hashes los arreglos pueden ser NULL
+        memcpy(buffer + offset, entry->frames, entry->num_frames * sizeof(uint32_t));
+        offset += entry->num_frames * sizeof(uint32_t);
+    }
+    if (entry->num_hashes > 0) {
+        memcpy(buffer + offset, entry->hashes, entry->num_hashes * sizeof(uint64_t));
+        offset += entry->num_hashes * sizeof(uint64_t);
+    }
+    if (entry->packed) {
+        uint32_t data_offset = entry->data_offset;
+        memcpy(buffer + offset, &data_offset, sizeof(data_offset));
+        offset += sizeof(data_offset);
+    }
+    if (entry->metadata.mode != 0) {
+        memcpy(buffer + offset, &entry->metadata, sizeof(EntryMetadata));
+        offset += sizeof(EntryMetadata);
+    }
+    return offset;
+}
+
+typedef struct {
+    IndexRecord record;
+    const char *name; // sin \0, record.name_length bytes
+    const unsigned char *extents; // record.num_extents pares (posición, bloques) de uint64_t
+    const unsigned char *frames; // num_frames uint32_t
+    size_t num_frames;
+    const unsigned char *hashes; // num_hashes uint64_t
+    size_t num_hashes;
+    uint32_t data_offset; // solo con RECORD_PACKED
+    EntryMetadata metadata; // en ceros sin RECORD_METADATA
+} RecordView;
+
+bool record_view(const unsigned char *buffer, size_t length, size_t *offset, size_t block_size, RecordView *view) {
+    // ubica las partes de un registro con el formato de entry_serialize sin copiarlas, false si está cortado o es invalido
+    size_t p = *offset;
+    if (length - p < sizeof(IndexRecord)) return false;
+    memcpy(&view->record, buffer + p, sizeof(IndexRecord));
+    p += sizeof(IndexRecord);
+
+    IndexRecord *record = &view->record;
+    int codec = record->flags & RECORD_CODEC_MASK;
+    view->num_frames = codec != CODEC_NONE || (record->flags & RECORD_FRAMES) ? blocks_for(record->file_size, block_size) : 0;
+    view->num_hashes = record->flags & RECORD_HASHES ? blocks_for(record->file_size, block_size) : 0;
+    if (codec >= (int)NUM_CODECS || record->name_length > length || record->num_extents > length || view->num_frames > length || view->num_hashes > length) return false;
+    size_t needed = record->name_length + record->num_extents * 2 * sizeof(uint64_t) + view->num_frames * sizeof(uint32_t) + view->num_hashes * sizeof(uint64_t);
+    if (record->flags & RECORD_PACKED) needed += sizeof(uint32_t);
+    if (record->flags & RECORD_METADATA) needed += sizeof(EntryMetadata);
+    if (needed > length - p) return false;
+
+    view->name = (const char *)buffer + p;
+    p += record->name_length;
+    view->extents = buffer + p;
+    p += record->num_extents * 2 * sizeof(uint64_t);
+    view->frames = buffer + p;
+    p += view->num_frames * sizeof(uint32_t);
+    view->hashes = buffer + p;
+    p += view->num_hashes * sizeof(uint64_t);
+    view->data_offset = 0;
+    if (record->flags & RECORD_PACKED) {
+        memcpy(&view->data_offset, buffer + p, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+    }
+    memset(&view->metadata, 0, sizeof(EntryMetadata));
+    if (record->flags & RECORD_METADATA) {
+        memcpy(&view->metadata, buffer + p, sizeof(EntryMetadata));
+        p += sizeof(EntryMetadata);
+    }
+    *offset = p;
+    return true;
+}
+
+FileEntry *entry_parse(Archive *ar, const unsigned char *buffer, size_t length, size_t *offset) {
+    // lee un registro con el formato de entry_serialize, NULL si está cortado o es invalido
+    RecordView view;
+    if (!record_view(buffer, length, offset, ar->sb.block_size, &view)) return NULL;
+
+    char *filename = xrealloc(NULL, view.record.name_length + 1);
+    memcpy(filename, view.name, view.record.name_length);
+    filename[view.record.name_length] = '\0';
+    FileEntry *entry = fat_find_or_add(&ar->fat, filename);
+    free(filename);
+    entry_reset(entry);
+    entry->file_size = view.record.file_size;
+    entry->codec = view.num_frames > 0 ? (int)(view.record.flags & RECORD_CODEC_MASK) : CODEC_NONE;
+    for (uint64_t j = 0; j < view.record.num_extents; j++) {
+        uint64_t pair[2];
+        memcpy(pair, view.extents + j * sizeof(pair), sizeof(pair));
+        entry_add_blocks(entry, pair[0], pair[1], ar->sb.block_size);
+    }
+    for (size_t j = 0; j < view.num_frames; j++) {
+        uint32_t frame;
+        memcpy(&frame, view.frames + j * sizeof(frame), sizeof(frame));
+        entry_add_frame(entry, frame);
+    }
+    for (size_t j = 0; j < view.num_hashes; j++) entry_add_hash(entry, read64(view.hashes + j * sizeof(uint64_t)));
+    if (view.record.flags & RECORD_PACKED) {
+        entry->packed = true;
+        entry->data_offset = view.data_offset;
+    }
+    if (view.record.flags & RECORD_METADATA) entry->metadata = view.metadata;
+    return entry;
+}
+
+bool load_index(Archive *ar) {
+    if (ar->sb.index_length == 0) return true;
+
+    unsigned char *buffer = xrealloc(NULL, ar->sb.index_length);
+    if (!pread_all(fileno(ar->file), buffer, ar->sb.index_length, ar->sb.index_offset)) {
+        free(buffer);
+        return false;
+    }
+
+    // recorrer solo los registros presentes, el costo depende de cuantos archivos hay
+    size_t offset = 0;
+    for (uint64_t i = 0; i < ar->sb.num_files; i++) {
+        if (entry_parse(ar, buffer, ar->sb.index_length, &offset) == NULL) break;
+    }
+
+    free(buffer);
+    if (ar->fat.num_files != ar->sb.num_files) {
+        fprintf(stderr, "Error: el índice del archivo empacado está incompleto\n");
+        return false;
+    }
+    return true;
+}
+
+bool valid_block_size(size_t block_size) {
+    // potencia de 2 entre 4 KB y 16 MB, asi los bloques quedan alineados a pagina
+    return block_size >= MIN_BLOCK_SIZE && block_size <= MAX_BLOCK_SIZE && (block_size & (block_size - 1)) == 0;
+}
+
+uint64_t superblock_checksum(const Superblock *sb) {
+    Superblock copy = *sb;
+    copy.checksum = 0;
+    return checksum64(&copy, sizeof(Superblock));
+}
+
+bool superblock_read(Archive *ar) {
+    // vale la copia con checksum correcto y mayor generación
+    bool found = false;
+    for (size_t slot = 0; slot < 2; slot++) {
+        Superblock sb;
+        if (!pread_all(fileno(ar->file), (unsigned char *)&sb, sizeof(Superblock), slot * SUPERBLOCK_SLOT) || sb.magic != STAR_MAGIC) continue;
+        if (sb.checksum == superblock_checksum(&sb) && (!found || sb.generation > ar->sb.generation)) {
+            ar->sb = sb;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void superblock_write(Archive *ar) {
+    // se escribe sobre la copia vieja, si se corta a la mitad queda la otra
+    ar->sb.generation++;
+    ar->sb.checksum = superblock_checksum(&ar->sb);
+    if (!pwrite_all(fileno(ar->file), (const unsigned char *)&ar->sb, sizeof(Superblock), (ar->sb.generation % 2) * SUPERBLOCK_SLOT)) {
+        fprintf(stderr, "Error al escribir el superbloque\n");
+        exit(1);
+    }
+}
+
+void journal_apply_move(Archive *ar, const JournalMove *move) {
+    for (size_t j = 0; j < ar->fat.num_files; j++) {
+        if (!ar->fat.files[j].deleted) entry_remap(&ar->fat.files[j], move->source, move->target, move->num_blocks, ar->sb.block_size);
+    }
+}
+
+unsigned char *journal_load(Archive *ar, size_t *available) {
+    // los bytes del registro en disco (lo escrito puede ser menos que su capacidad), NULL si no se pudieron leer
+    struct stat st;
+    if (fstat(fileno(ar->file), &st) != 0) return NULL;
+    *available = (size_t)st.st_size > ar->sb.journal_offset ? st.st_size - ar->sb.journal_offset : 0;
+    if (*available > ar->sb.journal_capacity) *available = ar->sb.journal_capacity;
+    unsigned char *buffer = xrealloc(NULL, *available + 1);
+    if (!pread_all(fileno(ar->file), buffer, *available, ar->sb.journal_offset)) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+const unsigned char *journal_next(Archive *ar, unsigned char *buffer, size_t available, size_t *offset, JournalHeader *header) {
+    // el contenido del registro siguiente, o NULL en el primero que no sea de esta generación o cuyo
+    // checksum no coincida (una escritura cortada)
+    if (available - *offset < sizeof(JournalHeader)) return NULL;
+    unsigned char *record = buffer + *offset;
+    memcpy(header, record, sizeof(JournalHeader));
+    if (header->sequence != ar->sb.journal_sequence || header->length > available - *offset - sizeof(JournalHeader)) return NULL;
+    uint64_t checksum = header->checksum;
+    header->checksum = 0;
+    memcpy(record, header, sizeof(JournalHeader));
+    if (checksum != checksum64(record, sizeof(JournalHeader) + header->length)) return NULL;
+    *offset += sizeof(JournalHeader) + header->length;
+    return record + sizeof(JournalHeader);
+}
+
+bool journal_replay(Archive *ar) {
+    // aplicar los cambios confirmados despues del ultimo índice completo
+    size_t available;
+    unsigned char *buffer = journal_load(ar, &available);
+    if (buffer == NULL) return false;
+
+    size_t offset = 0;
+    size_t next = 0;
+    JournalHeader header;
+    const unsigned char *payload;
+    while ((payload = journal_next(ar, buffer, available, &next, &header)) != NULL) {
+        size_t position = 0;
+        if (header.type == JOURNAL_PUT) {
+            if (entry_parse(ar, payload, header.length, &position) == NULL) break;
+        } else if (header.type == JOURNAL_DELETE) {
+            char *filename = xrealloc(NULL, header.length + 1);
+            memcpy(filename, payload, header.length);
+            filename[header.length] = '\0';
+            FileEntry *entry = fat_find(&ar->fat, filename);
+            if (entry != NULL) fat_remove(&ar->fat, entry);
+            free(filename);
+        } else if (header.type == JOURNAL_MOVE && header.length == sizeof(JournalMove)) {
+            JournalMove move;
+            memcpy(&move, payload, sizeof(JournalMove));
+            journal_apply_move(ar, &move);
+        } else {
+            break;
+        }
+        offset = next;
+    }
+    ar->journal_used = offset; // lo que sigue se sobrescribe con los proximos registros
+    free(buffer);
+    return true;
+}
+
+void archive_init_io(Archive *ar, const char *archive_name, bool writable) {
+    io_init(&ar->io, 0); // síncrono hasta que ingest_files arme su cola
+    // sin soporte (tmpfs, algunos sistemas de archivos en red) se sigue por la caché
+    ar->direct_fd = io_use_direct ? open(archive_name, (writable ? O_RDWR : O_RDONLY) | O_DIRECT) : -1;
+}
+
+bool archive_open(Archive *ar, const char *archive_name, bool writable) {
+    memset(ar, 0, sizeof(Archive));
+    ar->file = fopen(archive_name, writable ? "rb+" : "rb");
+    if (ar->file == NULL) {
+        fprintf(stderr, "Error al abrir el archivo empacado.\n");
+        return false;
+    }
+    ar->writable = writable;
+    atomic_init(&ar->copy_file_range_ok, true);
+    pthread_mutex_init(&ar->map_lock, NULL);
+
+    bool loaded;
+    uint64_t index_start = stats_index_begin();
+    if (superblock_read(ar)) {
+        if (ar->sb.version != STAR_VERSION) {
+            fprintf(stderr, "Error: versión de formato %u no soportada.\n", ar->sb.version);
+            loaded = false;
+        } else if (!valid_block_size(ar->sb.block_size)) {
+            fprintf(stderr, "Error: tamaño de bloque %u no soportado.\n", ar->sb.block_size);
+            loaded = false;
+        } else if (ar->sb.flags & ~SB_KNOWN_FLAGS) {
+            fprintf(stderr, "Error: el archivo usa funciones no soportadas (0x%x).\n", ar->sb.flags & ~SB_KNOWN_FLAGS);
+            loaded = false;
+        } else {
+            loaded = load_index(ar) && (ar->sb.journal_offset == 0 || journal_replay(ar));
+        }
+    } else {
+        loaded = load_legacy_fat(ar); // archivo del formato antiguo, se migra al guardar
+        ar->needs_checkpoint = true;
+    }
+    stats_index_end(index_start);
+
+    if (!loaded) {
+        fprintf(stderr, "Error al leer el índice de %s\n", archive_name);
+        fat_clear(&ar->fat);
+        fclose(ar->file);
+        return false;
+    }
+    archive_init_io(ar, archive_name, writable);
+
+    if (writable) {
+        fseek(ar->file, 0, SEEK_END);
+        allocator_build(&ar->alloc, ar, ftell(ar->file));
+        slabs_build(ar);
+        if (ar->sb.flags & SB_DEDUP) blocks_build(ar);
+    }
+    return true;
+}
+
+bool archive_create(Archive *ar, const char *archive_name, size_t block_size) {
+    memset(ar, 0, sizeof(Archive));
+    ar->file = fopen(archive_name, "wb+"); // abrir archivo como binario para escritura
+    if (ar->file == NULL) return false;
+    ar->writable = true;
+    ar->needs_checkpoint = true; // todavia no hay índice sobre el cual registrar cambios
+    atomic_init(&ar->copy_file_range_ok, true);
+    pthread_mutex_init(&ar->map_lock, NULL);
+
+    ar->sb.magic = STAR_MAGIC;
+    ar->sb.version = STAR_VERSION;
+    ar->sb.block_size = block_size;
+    ar->sb.data_start = SUPERBLOCK_SIZE; // el primer bloque de datos va despues del superbloque
+
+    static const unsigned char zeros[SUPERBLOCK_SIZE];
+    fwrite(zeros, sizeof(zeros), 1, ar->file); // reservar el superbloque (se escribe al guardar el índice)
+    fflush(ar->file);
+
+    allocator_build(&ar->alloc, ar, SUPERBLOCK_SIZE);
+    archive_init_io(ar, archive_name, true);
+    return true;
+}
+
+void archive_release_pending(Archive *ar) {
+    for (size_t i = 0; i < ar->num_pending; i++) allocator_free(&ar->alloc, ar->pending[i].position, ar->pending[i].num_blocks);
+    ar->num_pending = 0;
+}
+
+void archive_sync(int fd) {
+    // lo que sigue (superbloque, registro, bloques liberados) supone que lo anterior ya está en el disco
+    if (fdatasync(fd) != 0) {
+        fprintf(stderr, "Error al sincronizar el archivo empacado con el disco\n");
+        exit(1);
+    }
+}
+
+void write_fat(Archive *ar) {
+    // punto de control: el índice completo y un registro vacío van juntos a un espacio libre, y el
+    // superbloque se apunta a ellos recién cuando están en el disco
+    FAT *fat = &ar->fat;
+    size_t block_size = ar->sb.block_size;
+    io_wait(&ar->io, 0); // los datos en vuelo entran en el fdatasync de abajo
+    uint64_t index_start = stats_index_begin();
+
+    size_t length = 0;
+    for (size_t i = 0; i < fat->num_files; i++) {
+        if (!fat->files[i].deleted) length += entry_record_length(&fat->files[i]); // las lapidas no se escriben
+    }
+    unsigned char *buffer = xrealloc(NULL, length + 1);
+    size_t offset = 0;
+    for (size_t i = 0; i < fat->num_files; i++) {
+        if (!fat->files[i].deleted) offset += entry_serialize(&fat->files[i], buffer + offset);
+    }
+
+    // el registro empieza en la siguiente pagina despues del índice y se lleva el resto de los bloques
+    size_t journal_start = (length + JOURNAL_ALIGN - 1) / JOURNAL_ALIGN * JOURNAL_ALIGN;
+    size_t num_blocks = blocks_for(journal_start + (length > JOURNAL_MIN_SIZE ? length : JOURNAL_MIN_SIZE), block_size);
+
+    allocator_trim(&ar->alloc);
+    // mientras se desfragmenta van al final para no ocupar los huecos que se están llenando
+    size_t index_offset = ar->defragmenting ? (size_t)-1 : allocator_take(&ar->alloc, num_blocks);
+    if (index_offset == (size_t)-1) {
+        index_offset = ar->alloc.archive_end; // al final, sin reservar de más
+        ar->alloc.archive_end += num_blocks * block_size;
+    }
+    if (!pwrite_all(fileno(ar->file), buffer, length, index_offset)) {
+        fprintf(stderr, "Error al escribir el índice\n");
+        exit(1);
+    }
+    free(buffer);
+
+    Superblock old = ar->sb;
+    ar->sb.version = STAR_VERSION; // los archivos de formatos anteriores quedan migrados
+    ar->sb.index_offset = index_offset;
+    ar->sb.index_length = length;
+    ar->sb.num_files = fat->num_files - fat->num_deleted;
+    ar->sb.journal_offset = index_offset + journal_start;
+    ar->sb.journal_capacity = num_blocks * block_size - journal_start;
+    ar->sb.journal_sequence++; // los registros anteriores quedan incluidos en el índice
+
+    // datos y índice antes que el superbloque, y el superbloque antes de reusar lo que el anterior apuntaba
+    int fd = fileno(ar->file);
+    archive_sync(fd);
+    superblock_write(ar);
+    archive_sync(fd);
+    stats_count(&stats.syncs, 2);
+
+    // índice y registro anteriores, el registro va a continuación del índice
+    size_t old_blocks = old.journal_offset != 0
+        ? blocks_for(old.journal_offset + old.journal_capacity - old.index_offset, block_size)
+        : blocks_for(old.index_length, block_size);
+    if (old_blocks > 0) allocator_free(&ar->alloc, old.index_offset, old_blocks);
+    archive_release_pending(ar);
+    ar->journal_length = 0;
+    ar->journal_used = 0;
+    ar->needs_checkpoint = false;
+    allocator_trim(&ar->alloc);
+
+    // si el índice es lo ultimo del archivo el registro vacío no necesita ocupar espacio
+    size_t file_end = ar->alloc.archive_end;
+    if (index_offset + num_blocks * block_size == file_end) file_end = ar->sb.journal_offset;
+    ftruncate(fd, file_end);
+    stats_count(&stats.truncates, 1);
+    stats_index_end(index_start);
+}
+
+void journal_commit(Archive *ar) {
+    // confirmación en grupo: un fdatasync para los datos de todos los cambios del lote y otro para sus
+    // registros. Si el registro no alcanza (o no hay índice sobre el cual aplicarlo) se guarda el índice completo
+    io_wait(&ar->io, 0);
+    if (ar->needs_checkpoint || ar->journal_used + ar->journal_length > ar->sb.journal_capacity) {
+        write_fat(ar);
+        return;
+    }
+    if (ar->journal_length == 0) return;
+
+    uint64_t index_start = stats_index_begin();
+    int fd = fileno(ar->file);
+    archive_sync(fd);
+    if (!pwrite_all(fd, ar->journal, ar->journal_length, ar->sb.journal_offset + ar->journal_used)) {
+        fprintf(stderr, "Error al escribir el registro de cambios\n");
+        exit(1);
+    }
+    archive_sync(fd);
+    stats_count(&stats.syncs, 2);
+    stats_index_end(index_start);
+    ar->journal_used += ar->journal_length;
+    ar->journal_length = 0;
+    archive_release_pending(ar); // ya ningun estado confirmado apunta a estos bloques
+}
+
+unsigned char *journal_reserve(Archive *ar, size_t length) {
+    // lugar para un registro de hasta length bytes al final del lote, se cierra con journal_finish
+    if (ar->journal_length + sizeof(JournalHeader) + length > ar->journal_buffer_capacity) {
+        ar->journal_buffer_capacity = ar->journal_length + sizeof(JournalHeader) + length + JOURNAL_BATCH_SIZE;
+        ar->journal = xrealloc(ar->journal, ar->journal_buffer_capacity);
+    }
+    return ar->journal + ar->journal_length + sizeof(JournalHeader);
+}
+
+void journal_finish(Archive *ar, uint32_t type, size_t length) {
+    unsigned char *record = ar->journal + ar->journal_length;
+    JournalHeader header = {type, length, ar->sb.journal_sequence, 0};
+    memcpy(record, &header, sizeof(JournalHeader));
+    header.checksum = checksum64(record, sizeof(JournalHeader) + length);
+    memcpy(record, &header, sizeof(JournalHeader));
+    ar->journal_length += sizeof(JournalHeader) + length;
+
+    if (ar->journal_length >= JOURNAL_BATCH_SIZE) journal_commit(ar);
+}
+
+void journal_append(Archive *ar, uint32_t type, const void *payload, size_t length) {
+    memcpy(journal_reserve(ar, length), payload, length);
+    journal_finish(ar, type, length);
+}
+
+void journal_put(Archive *ar, FileEntry *entry) {
+    // la entrada se serializa directo en el lote, sin un buffer intermedio por archivo
+    size_t length = entry_serialize(entry, journal_reserve(ar, entry_record_length(entry)));
+    journal_finish(ar, JOURNAL_PUT, length);
+}
+
+void journal_delete(Archive *ar, const char *filename) {
+    journal_append(ar, JOURNAL_DELETE, filename, strlen(filename));
+}
+
+void archive_close(Archive *ar) {
+    if (ar->map != NULL) munmap(ar->map, ar->map_length);
+    if (ar->writable) {
+        // solo se confirman los cambios pendientes, el índice completo se reescribe cuando el registro se llena
+        journal_commit(ar);
+        allocator_trim(&ar->alloc);
+        struct stat st;
+        if (fstat(fileno(ar->file), &st) == 0 && (size_t)st.st_size > ar->alloc.archive_end) {
+            ftruncate(fileno(ar->file), ar->alloc.archive_end);
+            stats_count(&stats.truncates, 1);
+        }
+    }
+    if (stats.enabled) {
+        // fragmentación: extents por archivo con datos propios (1 es todo contiguo)
+        stats.members = stats.extents = 0;
+        for (size_t i = 0; i < ar->fat.num_files; i++) {
+            FileEntry *entry = &ar->fat.files[i];
+            if (entry->deleted || entry->packed || entry->num_extents == 0) continue;
+            stats.members++;
+            stats.extents += entry->num_extents;
+        }
+        stats.free_extents = ar->alloc.num_extents;
+    }
+    free(ar->alloc.extents);
+    free(ar->slabs);
+    free(ar->journal);
+    free(ar->pending);
+    free(ar->block_refs.slots);
+    free(ar->block_hashes.slots);
+    buffer_put(ar->dedup_buffer, ar->sb.block_size);
+    fat_clear(&ar->fat);
+    pthread_mutex_destroy(&ar->map_lock);
+    io_free(&ar->io);
+    if (ar->direct_fd >= 0) close(ar->direct_fd);
+    fclose(ar->file);
+}
+
+// -t: cada archivo es un ListEntry chico y los nombres van seguidos en una tabla de texto. Sin -v el listado se
+// arma leyendo solo el superbloque, el índice y el registro, sin el FAT (ni sus extents, tamaños y hashes)
+#define LIST_OUTPUT_SIZE (1024 * 1024) // la salida se junta y se escribe de a 1 MB
+
+typedef struct {
+    size_t name; // posición en la tabla de nombres, terminado en \0
+    uint64_t size;
+    uint64_t stored; // bytes guardados en el archivo empacado
+    size_t holes; // bloques sin datos guardados
+    size_t member; // posición en el FAT, solo si el listado sale de él
+    uint8_t codec;
+    bool packed;
+    bool deleted;
+    EntryMetadata metadata;
+} ListEntry;
+
+typedef struct {
+    ListEntry *entries;
+    size_t num_entries;
+    size_t capacity;
+    char *names;
+    size_t names_length;
+    size_t names_capacity;
+    size_t *buckets; // nombre -> posición en entries + 1, 0 es vacío; solo si el registro tiene cambios
+    size_t num_buckets; // potencia de 2, al menos el doble de lo que puede entrar
+    uint64_t *changed; // hash_name de los nombres que nombra el registro, 0 es vacío; solo esos van a buckets
+    size_t num_changed; // potencia de 2
+} Listing;
+
+typedef struct {
+    char *data;
+    size_t length;
+} ListOutput;
+
+const char *listing_name(Listing *listing, ListEntry *entry) {
+    return listing->names + entry->name;
+}
+
+const char *listing_stage_name(Listing *listing, const char *name, size_t length) {
+    // copia el nombre al final de la tabla sin agregarlo: sirve de clave con \0 y listing_add lo confirma
+    if (listing->names_length + length + 1 > listing->names_capacity) {
+        listing->names_capacity = (listing->names_length + length + 1) * 2;
+        listing->names = xrealloc(listing->names, listing->names_capacity);
+    }
+    char *staged = listing->names + listing->names_length;
+    memcpy(staged, name, length);
+    staged[length] = '\0';
+    return staged;
+}
+
+size_t listing_changed_slot(Listing *listing, uint64_t hash) {
+    size_t slot = hash & (listing->num_changed - 1);
+    while (listing->changed[slot] != 0 && listing->changed[slot] != hash) slot = (slot + 1) & (listing->num_changed - 1);
+    return slot;
+}
+
+void listing_prepare(Listing *listing, const char **names, const size_t *lengths, size_t count) {
+    // los cambios del registro se buscan por nombre, pero solo pueden encontrar archivos con esos nombres: el
+    // resto del índice no entra a la tabla. Un hash que coincide por azar solo agrega una entrada de más
+    listing->num_changed = listing->num_buckets = 1024;
+    while (listing->num_changed < 2 * count) listing->num_changed *= 2;
+    while (listing->num_buckets < 4 * count) listing->num_buckets *= 2; // los del índice y los que agrega el registro
+    listing->changed = calloc(listing->num_changed, sizeof(uint64_t));
+    listing->buckets = calloc(listing->num_buckets, sizeof(size_t));
+    if (listing->changed == NULL || listing->buckets == NULL) {
+        fprintf(stderr, "Error: memoria insuficiente\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint64_t hash = hash_name(listing_stage_name(listing, names[i], lengths[i])) | 1;
+        listing->changed[listing_changed_slot(listing, hash)] = hash;
+    }
+}
+
+ListEntry *listing_find(Listing *listing, const char *name) {
+    // las entradas borradas quedan en la tabla pero no se encuentran, un PUT posterior agrega otra al final
+    size_t slot = hash_name(name) & (listing->num_buckets - 1);
+    for (; listing->buckets[slot] != 0; slot = (slot + 1) & (listing->num_buckets - 1)) {
+        ListEntry *entry = &listing->entries[listing->buckets[slot] - 1];
+        if (!entry->deleted && strcmp(listing_name(listing, entry), name) == 0) return entry;
+    }
+    return NULL;
+}
+
+ListEntry *listing_add(Listing *listing, const char *name, size_t length) {
+    const char *staged = listing_stage_name(listing, name, length);
+    if (listing->num_entries == listing->capacity) {
+        listing->capacity = listing->capacity ? listing->capacity * 2 : 1024;
+        listing->entries = xrealloc(listing->entries, listing->capacity * sizeof(ListEntry));
+    }
+    ListEntry *entry = &listing->entries[listing->num_entries++];
+    memset(entry, 0, sizeof(ListEntry));
+    entry->name = listing->names_length;
+    listing->names_length += length + 1;
+    if (listing->buckets != NULL) {
+        uint64_t hash = hash_name(staged);
+        if (listing->changed[listing_changed_slot(listing, hash | 1)] != 0) {
+            size_t slot = hash & (listing->num_buckets - 1);
+            while (listing->buckets[slot] != 0) slot = (slot + 1) & (listing->num_buckets - 1);
+            listing->buckets[slot] = listing->num_entries;
+        }
+    }
+    return entry;
+}
+
+void listing_set(ListEntry *entry, const RecordView *view) {
+    entry->size = view->record.file_size;
+    entry->stored = view->num_frames == 0 ? view->record.file_size : 0;
+    entry->holes = 0;
+    for (size_t j = 0; j < view->num_frames; j++) {
+        uint32_t frame;
+        memcpy(&frame, view->frames + j * sizeof(frame), sizeof(frame));
+        entry->stored += frame & FRAME_SIZE_MASK;
+        entry->holes += frame == FRAME_HOLE;
+    }
+    entry->codec = view->num_frames > 0 ? view->record.flags & RECORD_CODEC_MASK : CODEC_NONE;
+    entry->packed = view->record.flags & RECORD_PACKED;
+    entry->deleted = false;
+    entry->metadata = view->metadata;
+}
+
+bool listing_load_index(Listing *listing, const char *archive_name) {
+    // false si el archivo no es del formato actual o algo no cuadra: el listado sale entonces del FAT,
+    // que ademas migra los formatos anteriores y reporta los errores
+    Archive ar;
+    memset(&ar, 0, sizeof(Archive));
+    ar.file = fopen(archive_name, "rb");
+    if (ar.file == NULL) return false;
+    uint64_t index_start = stats_index_begin();
+    bool ok = superblock_read(&ar) && ar.sb.version == STAR_VERSION && valid_block_size(ar.sb.block_size) && !(ar.sb.flags & ~SB_KNOWN_FLAGS);
+
+    // primero el registro, para saber que nombres cambian despues del índice
+    size_t available = 0;
+    unsigned char *journal = ok && ar.sb.journal_offset != 0 ? journal_load(&ar, &available) : NULL;
+    ok = ok && (ar.sb.journal_offset == 0 || journal != NULL);
+    size_t count = 0;
+    size_t capacity = available / sizeof(JournalHeader) + 1;
+    JournalHeader *headers = journal != NULL ? xrealloc(NULL, capacity * sizeof(JournalHeader)) : NULL;
+    const unsigned char **payloads = journal != NULL ? xrealloc(NULL, capacity * sizeof(char *)) : NULL;
+    const char **names = journal != NULL ? xrealloc(NULL, capacity * sizeof(char *)) : NULL;
+    size_t *lengths = journal != NULL ? xrealloc(NULL, capacity * sizeof(size_t)) : NULL;
+    size_t num_names = 0;
+    size_t next = 0;
+    RecordView view;
+    while (journal != NULL && (payloads[count] = journal_next(&ar, journal, available, &next, &headers[count])) != NULL) {
+        // los movimientos de -p solo cambian posiciones, que sin -v no se muestran
+        size_t position = 0;
+        if (headers[count].type == JOURNAL_PUT && record_view(payloads[count], headers[count].length, &position, ar.sb.block_size, &view)) {
+            names[num_names] = view.name;
+            lengths[num_names++] = view.record.name_length;
+        } else if (headers[count].type == JOURNAL_DELETE) {
+            names[num_names] = (const char *)payloads[count];
+            lengths[num_names++] = headers[count].length;
+        } else if (headers[count].type != JOURNAL_MOVE) {
+            break;
+        }
+        count++;
+    }
+    if (num_names > 0) listing_prepare(listing, names, lengths, num_names);
+    free(names);
+    free(lengths);
+
+    unsigned char *index = ok ? xrealloc(NULL, ar.sb.index_length + 1) : NULL;
+    ok = ok && pread_all(fileno(ar.file), index, ar.sb.index_length, ar.sb.index_offset);
+    if (ok && listing->capacity < ar.sb.num_files + count) {
+        // de una vez: los nombres del índice no ocupan mas que el índice
+        listing->capacity = ar.sb.num_files + count;
+        listing->entries = xrealloc(listing->entries, listing->capacity * sizeof(ListEntry));
+        listing->names_capacity = ar.sb.index_length + available + 1;
+        listing->names = xrealloc(listing->names, listing->names_capacity);
+    }
+    size_t offset = 0;
+    for (uint64_t i = 0; ok && i < ar.sb.num_files; i++) {
+        ok = record_view(index, ar.sb.index_length, &offset, ar.sb.block_size, &view);
+        if (ok) listing_set(listing_add(listing, view.name, view.record.name_length), &view);
+    }
+    free(index);
+
+    for (size_t i = 0; ok && i < count; i++) {
+        size_t position = 0;
+        if (headers[i].type == JOURNAL_PUT) {
+            record_view(payloads[i], headers[i].length, &position, ar.sb.block_size, &view);
+            ListEntry *entry = listing_find(listing, listing_stage_name(listing, view.name, view.record.name_length));
+            listing_set(entry != NULL ? entry : listing_add(listing, view.name, view.record.name_length), &view);
+        } else if (headers[i].type == JOURNAL_DELETE) {
+            ListEntry *entry = listing_find(listing, listing_stage_name(listing, (const char *)payloads[i], headers[i].length));
+            if (entry != NULL) entry->deleted = true;
+        }
+    }
+    free(headers);
+    free(payloads);
+    free(journal);
+    stats_index_end(index_start);
+    fclose(ar.file);
+    return ok;
+}
+
+void listing_from_fat(Listing *listing, Archive *ar) {
+    for (size_t i = 0; i < ar->fat.num_files; i++) {
+        FileEntry *file = &ar->fat.files[i];
+        if (file->deleted) continue;
+        ListEntry *entry = listing_add(listing, file->filename, strlen(file->filename));
+        entry->size = file->file_size;
+        entry->stored = file->num_frames > 0 ? file->frame_offsets[file->num_frames] : file->file_size;
+        for (size_t j = 0; j < file->num_frames; j++) entry->holes += file->frames[j] == FRAME_HOLE;
+        entry->member = i;
+        entry->codec = file->codec;
+        entry->packed = file->packed;
+        entry->metadata = file->metadata;
+    }
+}
+
+void listing_free(Listing *listing) {
+    free(listing->entries);
+    free(listing->names);
+    free(listing->buckets);
+    free(listing->changed);
+}
+
+bool list_matches(const char *name, const char *pattern) {
+    // nombre exacto, patrón (*, ?, [...]) o un directorio que contiene al archivo ("dir" o "dir/")
+    size_t length = strlen(pattern);
+    if (length > 1 && pattern[length - 1] == '/') length--;
+    if (strncmp(name, pattern, length) == 0 && (name[length] == '\0' || name[length] == '/')) return true;
+    return strpbrk(pattern, "*?[") != NULL && fnmatch(pattern, name, 0) == 0;
+}
+
+typedef struct {
+    const char *names;
+    int sort;
+} ListOrder;
+
+int compare_list_entries(const void *a, const void *b, void *context) {
+    const ListEntry *x = a, *y = b;
+    ListOrder *order = context;
+    if (order->sort == LIST_SORT_SIZE && x->size != y->size) return x->size > y->size ? -1 : 1; // de mayor a menor
+    return strcmp(order->names + x->name, order->names + y->name);
+}
+
+void list_flush(ListOutput *out) {
+    fflush(stdout); // lo que otra operación haya dejado en stdio va antes
+    if (out->length > 0 && !write_all(STDOUT_FILENO, (unsigned char *)out->data, out->length)) {
+        fprintf(stderr, "Error al escribir el listado\n");
+        exit(1);
+    }
+    out->length = 0;
+}
+
+void list_append(ListOutput *out, const char *data, size_t length) {
+    if (out->length + length > LIST_OUTPUT_SIZE) list_flush(out);
+    if (length > LIST_OUTPUT_SIZE) {
+        if (!write_all(STDOUT_FILENO, (const unsigned char *)data, length)) {
+            fprintf(stderr, "Error al escribir el listado\n");
+            exit(1);
+        }
+        return;
+    }
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+}
+
+void list_number(ListOutput *out, uint64_t value) {
+    char digits[24];
+    size_t n = sizeof(digits);
+    do {
+        digits[--n] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    list_append(out, digits + n, sizeof(digits) - n);
+}
+
+void list_printf(ListOutput *out, const char *format, ...) {
+    // para las lineas de -v; el listado simple arma sus lineas sin printf
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0) list_append(out, line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+}
+
+void list_json_string(ListOutput *out, const char *text) {
+    list_append(out, "\"", 1);
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            char escaped[2] = {'\\', *p};
+            list_append(out, escaped, 2);
+        } else if (*p < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", *p);
+            list_append(out, escaped, 6);
+        } else {
+            list_append(out, (const char *)p, 1);
+        }
+    }
+    list_append(out, "\"", 1);
+}
+
+void list_json_entry(ListOutput *out, Listing *listing, ListEntry *entry, Archive *ar) {
+    // un objeto por linea (JSON Lines); con -v (ar no es NULL) tambien sus extents
+    list_append(out, "{\"name\":", 8);
+    list_json_string(out, listing_name(listing, entry));
+    list_append(out, ",\"size\":", 8);
+    list_number(out, entry->size);
+    list_append(out, ",\"stored\":", 10);
+    list_number(out, entry->stored);
+    list_append(out, ",\"codec\":", 9);
+    list_json_string(out, codecs[entry->codec].name);
+    if (entry->packed) list_append(out, ",\"packed\":true", 14);
+    if (entry->holes > 0) {
+        list_append(out, ",\"holes\":", 9);
+        list_number(out, entry->holes);
+    }
+    if (entry->metadata.mode != 0) {
+        list_printf(out, ",\"mode\":%u,\"uid\":%u,\"gid\":%u,\"mtime\":%lld", entry->metadata.mode, entry->metadata.uid,
+                    entry->metadata.gid, (long long)entry->metadata.mtime);
+    }
+    if (ar != NULL) {
+        FileEntry *file = &ar->fat.files[entry->member];
+        list_append(out, ",\"extents\":[", 12);
+        for (size_t j = 0; j < file->num_extents; j++) {
+            list_append(out, j > 0 ? ",[" : "[", j > 0 ? 2 : 1);
+            list_number(out, file->extents[j].position);
+            list_append(out, ",", 1);
+            list_number(out, file->extents[j].num_blocks);
+            list_append(out, "]", 1);
+        }
+        list_append(out, "]", 1);
+    }
+    list_append(out, "}\n", 2);
+}
+
+void list_details(ListOutput *out, Archive *ar, ListEntry *entry) {
+    // -v en texto
+    FileEntry *file = &ar->fat.files[entry->member];
+    list_append(out, "  Bloques: ", 11);
+    for (size_t j = 0; j < file->num_extents; j++) {
+        for (size_t k = 0; k < file->extents[j].num_blocks; k++) {
+            list_number(out, file->extents[j].position + k * ar->sb.block_size);
+            list_append(out, " ", 1);
+        }
+    }
+    list_append(out, "\n", 1);
+    if (file->packed) list_printf(out, "  Empaquetado en el bloque %zu, desplazamiento %zu\n", (size_t)file->extents[0].position, file->data_offset);
+    if (file->codec != CODEC_NONE) list_printf(out, "  Compresión: %s (%zu bytes almacenados)\n", codecs[file->codec].name, (size_t)entry->stored);
+    if (entry->holes > 0) list_printf(out, "  Huecos: %zu bloques sin datos guardados\n", entry->holes);
+    if (file->metadata.mode != 0) {
+        list_printf(out, "  Modo %06o, dueño %u:%u, modificado %lld\n", file->metadata.mode, file->metadata.uid, file->metadata.gid, (long long)file->metadata.mtime);
+    }
+}
+
+bool list_archive_contents(const char *archive_name, char **patterns, int num_patterns, int sort, bool json, bool verbose) {
+    Listing listing;
+    memset(&listing, 0, sizeof(Listing));
+    Archive ar;
+    bool opened = false; // con -v o si el índice no se pudo leer directo
+    if (verbose || !listing_load_index(&listing, archive_name)) {
+        listing_free(&listing);
+        memset(&listing, 0, sizeof(Listing));
+        if (!archive_open(&ar, archive_name, false)) return false;
+        opened = true;
+        listing_from_fat(&listing, &ar);
+    }
+
+    // filtrar en el lugar, cada patrón recuerda si eligió algo
+    bool *matched = calloc(num_patterns + 1, sizeof(bool));
+    if (matched == NULL) {
+        fprintf(stderr, "Error: memoria insuficiente\n");
+        exit(1);
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < listing.num_entries; i++) {
+        ListEntry *entry = &listing.entries[i];
+        if (entry->deleted) continue;
+        bool chosen = num_patterns == 0;
+        for (int p = 0; p < num_patterns; p++) {
+            if (list_matches(listing_name(&listing, entry), patterns[p])) matched[p] = chosen = true;
+        }
+        if (chosen) listing.entries[count++] = *entry;
+    }
+    listing.num_entries = count;
+    bool ok = true;
+    for (int p = 0; p < num_patterns; p++) {
+        if (!matched[p]) {
+            fprintf(stderr, "Archivo '%s' no encontrado en el archivo empacado.\n", patterns[p]);
+            ok = false;
+        }
+    }
+    free(matched);
+
+    if (sort != LIST_SORT_NONE) {
+        ListOrder order = {listing.names, sort};
+        qsort_r(listing.entries, listing.num_entries, sizeof(ListEntry), compare_list_entries, &order);
+    }
+
+    ListOutput out = {buffer_get(LIST_OUTPUT_SIZE), 0};
+    if (!json) {
+        const char header[] = "Contenido del archivo empacado:\n-------------------------------\n";
+        list_append(&out, header, sizeof(header) - 1);
+    }
+    for (size_t i = 0; i < listing.num_entries; i++) {
+        ListEntry *entry = &listing.entries[i];
+        if (json) {
+            list_json_entry(&out, &listing, entry, verbose ? &ar : NULL);
+            continue;
+        }
+        const char *name = listing_name(&listing, entry);
+        list_append(&out, name, strlen(name));
+        list_append(&out, "\t", 1);
+        list_number(&out, entry->size);
+        list_append(&out, " bytes\n", 7);
+        if (verbose) list_details(&out, &ar, entry);
+    }
+    list_flush(&out);
+    buffer_put(out.data, LIST_OUTPUT_SIZE);
+
+    listing_free(&listing);
+    if (opened) archive_close(&ar);
+    return ok;
+}
+
+
+typedef void (*TaskFunction)(void *context, size_t task);
+
+typedef struct {
+    TaskFunction function;
+    void *context;
+    size_t num_tasks;
+    atomic_size_t next_task;
+} TaskPool;
+
+void *task_pool_worker(void *arg) {
+    TaskPool *pool = arg;
+    size_t task;
+    while ((task = atomic_fetch_add(&pool->next_task, 1)) < pool->num_tasks) pool->function(pool->context, task);
+    return NULL;
+}
+
+void run_parallel(TaskFunction function, void *context, size_t num_tasks, int num_jobs) {
+    // cada hilo toma la siguiente tarea libre hasta que se acaban
+    TaskPool pool = {.function = function, .context = context, .num_tasks = num_tasks};
+    atomic_init(&pool.next_task, 0);
+    if ((size_t)num_jobs > num_tasks) num_jobs = num_tasks;
+    if (num_jobs <= 1) {
+        task_pool_worker(&pool);
+        return;
+    }
+
+    pthread_t *threads = xrealloc(NULL, (num_jobs - 1) * sizeof(pthread_t));
+    int started = 0;
+    while (started < num_jobs - 1 && pthread_create(&threads[started], NULL, task_pool_worker, &pool) == 0) started++;
+    task_pool_worker(&pool); // el hilo principal también trabaja
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+typedef struct {
+    size_t run_position; // inicio de la corrida contigua reservada
+    size_t run_blocks; // bloques de la corrida
+    size_t run_used; // bytes ya escritos en la corrida
+} StreamWriter;
+
+size_t stream_write(Archive *ar, FileEntry *entry, StreamWriter *writer, const unsigned char *data, size_t length, size_t wanted_blocks, IoBatch *batch) {
+    // los datos almacenados de un archivo van uno tras otro sobre sus extents, sin relleno entre bloques.
+    // Con batch las escrituras quedan en vuelo en ar->io y data tiene que seguir valiendo hasta que termine
+    size_t first_position = (size_t)-1; // devuelve donde quedó el primer byte
+    while (length > 0) {
+        if (writer->run_used == writer->run_blocks * ar->sb.block_size) {
+            writer->run_position = allocator_alloc(&ar->alloc, ar->file, wanted_blocks);
+            writer->run_blocks = wanted_blocks;
+            writer->run_used = 0;
+        }
+
+        size_t n = writer->run_blocks * ar->sb.block_size - writer->run_used;
+        if (n > length) n = length;
+        if (first_position == (size_t)-1) first_position = writer->run_position + writer->run_used;
+        io_batch_write(&ar->io, batch, fileno(ar->file), data, n, writer->run_position + writer->run_used);
+
+        // registrar en la entrada los bloques que se empezaron a usar
+        size_t used_blocks = blocks_for(writer->run_used, ar->sb.block_size);
+        size_t new_used_blocks = blocks_for(writer->run_used + n, ar->sb.block_size);
+        if (new_used_blocks > used_blocks) {
+            entry_add_blocks(entry, writer->run_position + used_blocks * ar->sb.block_size, new_used_blocks - used_blocks, ar->sb.block_size);
+        }
+        writer->run_used += n;
+        data += n;
+        length -= n;
+    }
+    return first_position;
+}
+
+void zero_range(Archive *ar, size_t offset, size_t length) {
+    // el hueco devuelve ceros sin escribirlos; si el sistema de archivos no lo soporta se escriben
+    int fd = fileno(ar->file);
+    if (length == 0) return;
+    stats_count(&stats.truncates, 1);
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0) return;
+    unsigned char *zeros = buffer_get(length);
+    memset(zeros, 0, length);
+    if (!pwrite_all(fd, zeros, length, offset)) {
+        fprintf(stderr, "Error al escribir en el archivo empacado\n");
+        exit(1);
+    }
+    buffer_put(zeros, length);
+}
+
+void stream_finish(Archive *ar, StreamWriter *writer) {
+    // rellenar con ceros el final del ultimo bloque (podia tener datos de un archivo borrado) y devolver lo que sobro de la corrida
+    size_t used_blocks = blocks_for(writer->run_used, ar->sb.block_size);
+    zero_range(ar, writer->run_position + writer->run_used, used_blocks * ar->sb.block_size - writer->run_used);
+    allocator_free(&ar->alloc, writer->run_position + used_blocks * ar->sb.block_size, writer->run_blocks - used_blocks);
+    memset(writer, 0, sizeof(StreamWriter));
+}
+
+ssize_t read_block(int fd, unsigned char *data, size_t block_size) {
+    // llenar el bloque completo salvo al final del archivo (los pipes devuelven lecturas parciales)
+    size_t filled = 0;
+    while (filled < block_size) {
+        uint64_t start = stats_now();
+        ssize_t n = read(fd, data + filled, block_size - filled);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        stats_io(fd, (size_t)-1, n, false, start);
+        filled += n;
+    }
+    return filled;
+}
+
+ssize_t pread_block(int fd, unsigned char *data, size_t length, size_t offset) {
+    // como read_block pero en una posición, para poder saltar los huecos sin leerlos
+    size_t filled = 0;
+    while (filled < length) {
+        uint64_t start = stats_now();
+        ssize_t n = pread(fd, data + filled, length - filled, offset + filled);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        stats_io(fd, offset + filled, n, false, start);
+        filled += n;
+    }
+    return filled;
+}
+
+bool block_is_zero(const unsigned char *data, size_t length) {
+    // el primer byte en 0 y cada uno igual al siguiente: memcmp de glibc ya compara con SIMD
+    return length > 0 && data[0] == 0 && memcmp(data, data + 1, length - 1) == 0;
+}
+
+typedef struct IngestBuffer {
+    unsigned char *data;
+    size_t length; // bytes leidos
+    unsigned char *packed; // salida del compresor
+    uint32_t frame; // tamaño almacenado y FRAME_RAW si quedó sin comprimir
+    uint64_t hash; // del contenido leido, lo calcula el lector
+    bool zero; // solo ceros (un hueco del archivo o un bloque leido en 0): no se guarda
+    IoBatch io; // sus escrituras en vuelo, vuelve al pool cuando terminan
+    struct IngestPipeline *pipeline;
+    struct IngestBuffer *next;
+} IngestBuffer;
+
+typedef struct {
+    const char *filename;
+    int fd; // -1 si lo abre el lector
+    size_t expected_size; // 0 si no se conoce (ej. stdin)
+    int codec;
+    IngestBuffer *head; // bloques leidos esperando al escritor, en orden
+    IngestBuffer *tail;
+    bool done; // el lector llegó al final del archivo
+    bool failed;
+    EntryMetadata metadata; // del recorrido de directorios; si mode es 0 el lector la toma con fstat
+    bool sparse; // ocupa en disco menos que su tamaño: no se reserva espacio para todo de una vez
+} IngestFile;
+
+typedef struct IngestPipeline {
+    IngestFile *files;
+    size_t num_files;
+    size_t next_file; // siguiente archivo sin lector
+    size_t current_file; // archivo que está escribiendo el escritor
+    IngestBuffer *free_buffers; // pool acotado de bloques reutilizables
+    size_t num_free_buffers;
+    size_t block_size; // tamaño de cada bloque del pool, el del archivo empacado
+    size_t reserved_buffers; // bloques que solo puede tomar el archivo actual, evita que los lectores adelantados lo dejen sin bloques
+    uint64_t zero_hash; // de un bloque completo de ceros, los huecos no se leen
+    pthread_mutex_t lock;
+    pthread_cond_t buffer_returned;
+    pthread_cond_t block_ready;
+} IngestPipeline;
+
+void *ingest_reader(void *arg) {
+    IngestPipeline *pipeline = arg;
+    for (;;) {
+        pthread_mutex_lock(&pipeline->lock);
+        size_t index = pipeline->next_file++;
+        pthread_mutex_unlock(&pipeline->lock);
+        if (index >= pipeline->num_files) return NULL;
+
+        IngestFile *file = &pipeline->files[index];
+        bool special = S_ISDIR(file->metadata.mode) || S_ISLNK(file->metadata.mode); // vienen del recorrido de directorios
+        if (file->fd < 0 && !special) file->fd = open(file->filename, O_RDONLY); // abrir archivo como binario para lectura
+        struct stat st;
+        bool seekable = file->fd >= 0 && fstat(file->fd, &st) == 0 && S_ISREG(st.st_mode);
+        if (seekable) {
+            file->expected_size = st.st_size;
+            file->sparse = (size_t)st.st_blocks * 512 < (size_t)st.st_size;
+            if (file->metadata.mode == 0) file->metadata = metadata_from_stat(&st);
+        }
+        size_t offset = 0;
+        size_t hole_until = 0; // [offset, hole_until) es un hueco segun SEEK_DATA
+        size_t data_until = 0; // [offset, data_until) tiene datos segun SEEK_HOLE
+
+        bool failed = file->fd < 0 && !special;
+        while (!failed && !S_ISDIR(file->metadata.mode)) {
+            pthread_mutex_lock(&pipeline->lock);
+            while (pipeline->num_free_buffers == 0 ||
+                   (index != pipeline->current_file && pipeline->num_free_buffers <= pipeline->reserved_buffers)) {
+                pthread_cond_wait(&pipeline->buffer_returned, &pipeline->lock);
+            }
+            IngestBuffer *buffer = pipeline->free_buffers;
+            pipeline->free_buffers = buffer->next;
+            pipeline->num_free_buffers--;
+            pthread_mutex_unlock(&pipeline->lock);
+
+            // el contenido de un enlace simbólico es su destino, entra en un bloque (MIN_BLOCK_SIZE es PATH_MAX)
+            ssize_t bytes_read;
+            buffer->zero = false;
+            if (special) {
+                bytes_read = readlink(file->filename, (char *)buffer->data, pipeline->block_size);
+            } else if (seekable) {
+                // un bloque que cae entero en un hueco no se lee: el kernel dice donde siguen los datos
+                size_t length = pipeline->block_size;
+                if (offset < file->expected_size && file->expected_size - offset < length) length = file->expected_size - offset;
+                if (offset < file->expected_size && offset + length > hole_until && offset + length > data_until) {
+                    off_t data = lseek(file->fd, offset, SEEK_DATA);
+                    stats_count(&stats.seeks, 1);
+                    if (data < 0) data = errno == ENXIO ? (off_t)file->expected_size : (off_t)offset; // ENXIO: hueco hasta el final
+                    if ((size_t)data > offset) {
+                        hole_until = data;
+                    } else {
+                        off_t hole = lseek(file->fd, offset, SEEK_HOLE);
+                        stats_count(&stats.seeks, 1);
+                        data_until = hole > (off_t)offset ? (size_t)hole : file->expected_size;
+                    }
+                }
+                if (offset + length <= hole_until) {
+                    bytes_read = length;
+                    buffer->zero = true;
+                } else {
+                    bytes_read = pread_block(file->fd, buffer->data, length, offset);
+                }
+            } else {
+                bytes_read = read_block(file->fd, buffer->data, pipeline->block_size);
+            }
+            failed = bytes_read < 0;
+            if (bytes_read > 0) {
+                offset += bytes_read;
+                if (!buffer->zero) buffer->zero = block_is_zero(buffer->data, bytes_read);
+                if (buffer->zero && (size_t)bytes_read == pipeline->block_size) {
+                    buffer->hash = pipeline->zero_hash;
+                } else {
+                    if (buffer->zero) memset(buffer->data, 0, bytes_read); // ultimo bloque de un hueco, es corto
+                    buffer->hash = hash_block(buffer->data, bytes_read);
+                }
+            }
+
+            pthread_mutex_lock(&pipeline->lock);
+            if (bytes_read > 0) {
+                buffer->length = bytes_read;
+                buffer->next = NULL;
+                if (file->tail != NULL) file->tail->next = buffer;
+                else file->head = buffer;
+                file->tail = buffer;
+                pthread_cond_broadcast(&pipeline->block_ready);
+            } else {
+                buffer->next = pipeline->free_buffers;
+                pipeline->free_buffers = buffer;
+                pipeline->num_free_buffers++;
+                pthread_cond_broadcast(&pipeline->buffer_returned);
+            }
+            pthread_mutex_unlock(&pipeline->lock);
+            if (bytes_read <= 0 || special) break;
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        file->failed = failed;
+        file->done = true;
+        pthread_cond_broadcast(&pipeline->block_ready);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+}
+
+typedef struct {
+    IngestBuffer **batch;
+    int codec;
+} CompressJob;
+
+void compress_task(void *context, size_t task) {
+    CompressJob *job = context;
+    IngestBuffer *buffer = job->batch[task];
+    if (buffer->zero) {
+        buffer->frame = FRAME_HOLE;
+        return;
+    }
+    size_t packed = codecs[job->codec].compress(buffer->data, buffer->length, buffer->packed, LZ_BOUND(buffer->length));
+    if (packed == 0 || packed >= buffer->length) buffer->frame = buffer->length | FRAME_RAW; // no vale la pena comprimirlo
+    else buffer->frame = packed;
+}
+
+void ingest_return_buffer(IngestPipeline *pipeline, IngestBuffer *buffer) {
+    pthread_mutex_lock(&pipeline->lock);
+    buffer->next = pipeline->free_buffers;
+    pipeline->free_buffers = buffer;
+    pipeline->num_free_buffers++;
+    pthread_cond_broadcast(&pipeline->buffer_returned);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+void ingest_buffer_written(IoBatch *batch) {
+    IngestBuffer *buffer = (IngestBuffer *)((unsigned char *)batch - offsetof(IngestBuffer, io));
+    if (batch->failed) {
+        fprintf(stderr, "Error al escribir en el archivo empacado\n");
+        exit(1);
+    }
+    ingest_return_buffer(buffer->pipeline, buffer);
+}
+
+void ingest_wait_block(Archive *ar, IngestPipeline *pipeline) {
+    // se llama con el lock tomado. Con escrituras en vuelo no se duerme en block_ready: los lectores
+    // pueden estar esperando justo los bloques que vuelven al pool cuando esas escrituras terminan
+    if (ar->io.in_flight == 0) {
+        pthread_cond_wait(&pipeline->block_ready, &pipeline->lock);
+        return;
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    io_reap(&ar->io, true);
+    pthread_mutex_lock(&pipeline->lock);
+}
+
+size_t ingest_write_file(Archive *ar, IngestPipeline *pipeline, IngestFile *file, FileEntry *entry, int jobs, bool very_verbose) {
+    size_t file_size = 0;
+    size_t block_count = 0;
+    size_t stream_blocks = 0;
+    StreamWriter writer = {0};
+    size_t batch_size = file->codec != CODEC_NONE ? pipeline->reserved_buffers : 1;
+    IngestBuffer **batch = xrealloc(NULL, batch_size * sizeof(IngestBuffer *));
+
+    entry->codec = file->codec;
+    for (;;) {
+        // juntar varios bloques seguidos del archivo para comprimirlos en paralelo
+        size_t count = 0;
+        pthread_mutex_lock(&pipeline->lock);
+        while (count < batch_size) {
+            if (file->head != NULL) {
+                batch[count++] = file->head;
+                file->head = file->head->next;
+                if (file->head == NULL) file->tail = NULL;
+            } else if (file->done) {
+                break;
+            } else {
+                ingest_wait_block(ar, pipeline);
+            }
+        }
+        size_t expected_size = file->expected_size;
+        pthread_mutex_unlock(&pipeline->lock);
+        if (count == 0) break;
+
+        if (file->codec != CODEC_NONE) {
+            CompressJob job = {batch, file->codec};
+            run_parallel(compress_task, &job, count, jobs);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            IngestBuffer *buffer = batch[i];
+            buffer->io = (IoBatch){1, false, ingest_buffer_written}; // la referencia del escritor, hasta io_batch_release
+            if (buffer->zero) {
+                // hueco: solo queda en la tabla de tamaños, que un archivo sin compresión empieza a tener aquí
+                for (size_t b = entry->num_frames; b < block_count; b++) entry_add_frame(entry, ar->sb.block_size | FRAME_RAW);
+                entry_add_frame(entry, FRAME_HOLE);
+                superblock_require(ar, SB_SPARSE);
+                entry->file_size += buffer->length;
+                entry_add_hash(entry, buffer->hash);
+                file_size += buffer->length;
+                block_count++;
+                TRACE_BLOCK(very_verbose, "Bloque %zu del archivo '%s' es un hueco\n", block_count, entry->filename);
+                io_batch_release(&buffer->io);
+                continue;
+            }
+
+            // pedir de una vez todos los bloques que faltan, o un trozo si no se sabe cuanto viene
+            size_t wanted = blocks_in(GROWTH_CHUNK_SIZE, ar->sb.block_size);
+            if (expected_size > file_size) wanted = blocks_for(expected_size - file_size, ar->sb.block_size);
+            // no se sabe cuanto va a estar repetido o en huecos: la reserva se duplica al llenarse
+            if ((ar->dedup || file->sparse) && wanted > stream_blocks + 1) wanted = stream_blocks + 1;
+
+            const unsigned char *stored = buffer->data;
+            size_t stored_length = buffer->length;
+            if (file->codec != CODEC_NONE) {
+                if (!(buffer->frame & FRAME_RAW)) stored = buffer->packed;
+                stored_length = buffer->frame & FRAME_SIZE_MASK;
+                entry_add_frame(entry, buffer->frame);
+            } else if (entry->num_frames > 0) {
+                entry_add_frame(entry, buffer->length | FRAME_RAW); // ya tuvo un hueco
+            }
+
+            size_t position;
+            if (file_size == 0 && buffer->length < ar->sb.block_size && stored_length < PACK_THRESHOLD(ar->sb.block_size)) {
+                // archivo pequeño (un bloque incompleto solo se lee al final): va a un bloque compartido
+                size_t slab_index = slab_place(ar, stored_length); // puede mover ar->slabs
+                Slab *slab = &ar->slabs[slab_index];
+                position = slab->position + slab->used;
+                io_batch_write(&ar->io, &buffer->io, fileno(ar->file), stored, stored_length, position);
+                entry_add_blocks(entry, slab->position, 1, ar->sb.block_size);
+                entry->packed = true;
+                entry->data_offset = slab->used;
+                slab->used += stored_length;
+                slab->live_members++;
+            } else if (ar->dedup && file->codec == CODEC_NONE && (position = dedup_find(ar, stored, stored_length, buffer->hash)) != (size_t)-1) {
+                entry_add_blocks(entry, position, 1, ar->sb.block_size); // mismo contenido que un bloque ya guardado
+            } else {
+                position = stream_write(ar, entry, &writer, stored, stored_length, wanted, &buffer->io);
+                stream_blocks++;
+                if ((ar->sb.flags & SB_DEDUP) && file->codec == CODEC_NONE) block_add(ar, position, buffer->hash);
+            }
+            entry->file_size += buffer->length;
+            entry_add_hash(entry, buffer->hash);
+
+            file_size += buffer->length;
+            block_count++;
+
+            TRACE_BLOCK(very_verbose, "Bloque %zu del archivo '%s' escrito en la posición %zu\n", block_count, entry->filename, position);
+            io_batch_release(&buffer->io);
+        }
+    }
+
+    stream_finish(ar, &writer);
+    if (entry->num_frames == 0) entry->codec = CODEC_NONE; // vacío o directorio: no hay nada comprimido
+    free(batch);
+    return file_size;
+}
+
+typedef struct {
+    bool stop_on_error; // create aborta si no puede abrir una entrada, append y update la saltan
+    const char *error_format; // recibe el nombre del archivo
+    const char *done_format; // recibe el nombre y el tamaño, solo con -v
+    bool verbose;
+    bool very_verbose;
+} IngestOptions;
+
+void dedup_report(Archive *ar, bool verbose) {
+    if (verbose && ar->dedup) {
+        printf("Deduplicación: %zu bloques repetidos (%zu bytes) no se volvieron a escribir.\n", ar->dedup_blocks, ar->dedup_blocks * ar->sb.block_size);
+    }
+}
+
+bool ingest_files(Archive *ar, IngestFile *files, size_t num_files, int jobs, IngestOptions *options) {
+    // varios lectores llenan bloques de distintos archivos en paralelo y un solo escritor (este hilo)
+    // los guarda en orden de archivo, asi la lectura de las entradas se solapa con la escritura.
+    // false si alguna entrada no se pudo leer completa
+    IngestPipeline pipeline;
+    memset(&pipeline, 0, sizeof(IngestPipeline));
+    pipeline.files = files;
+    pipeline.num_files = num_files;
+    pipeline.block_size = ar->sb.block_size;
+    unsigned char *zeros = buffer_get(pipeline.block_size);
+    memset(zeros, 0, pipeline.block_size);
+    pipeline.zero_hash = hash_block(zeros, pipeline.block_size);
+    buffer_put(zeros, pipeline.block_size);
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.buffer_returned, NULL);
+    pthread_cond_init(&pipeline.block_ready, NULL);
+
+    bool compressed = false;
+    bool ok = true;
+    for (size_t i = 0; i < num_files; i++) compressed |= files[i].codec != CODEC_NONE;
+
+    // con compresión el archivo actual se reserva un lote de bloques para comprimirlos en paralelo
+    size_t num_readers = (size_t)jobs < num_files ? (size_t)jobs : num_files;
+    pipeline.reserved_buffers = compressed ? 2 * (size_t)jobs : 1;
+    size_t num_buffers = 2 * num_readers + 1 + pipeline.reserved_buffers;
+    size_t block_size = pipeline.block_size;
+    unsigned char *buffer_memory = buffer_get(num_buffers * block_size);
+    unsigned char *packed_memory = compressed ? buffer_get(num_buffers * LZ_BOUND(block_size)) : NULL;
+    IngestBuffer *buffers = xrealloc(NULL, num_buffers * sizeof(IngestBuffer));
+    for (size_t i = 0; i < num_buffers; i++) {
+        buffers[i].data = buffer_memory + i * block_size;
+        buffers[i].packed = compressed ? packed_memory + i * LZ_BOUND(block_size) : NULL;
+        buffers[i].pipeline = &pipeline;
+        buffers[i].next = pipeline.free_buffers;
+        pipeline.free_buffers = &buffers[i];
+    }
+    pipeline.num_free_buffers = num_buffers;
+
+    // cada bloque del pool puede tener dos escrituras en vuelo (su trozo cruza dos corridas)
+    io_init(&ar->io, 2 * num_buffers);
+    struct iovec regions[2] = {{buffer_memory, num_buffers * block_size}, {packed_memory, num_buffers * LZ_BOUND(block_size)}};
+    io_register_buffers(&ar->io, regions, compressed ? 2 : 1);
+    io_set_direct(&ar->io, fileno(ar->file), ar->direct_fd);
+
+    pthread_t *readers = xrealloc(NULL, (num_readers + 1) * sizeof(pthread_t));
+    size_t started = 0;
+    while (started < num_readers && pthread_create(&readers[started], NULL, ingest_reader, &pipeline) == 0) started++;
+    if (started == 0 && num_files > 0) {
+        fprintf(stderr, "Error al crear los hilos lectores\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < num_files; i++) {
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.current_file = i;
+        pthread_cond_broadcast(&pipeline.buffer_returned); // el lector del archivo actual puede usar la reserva
+        pthread_mutex_unlock(&pipeline.lock);
+
+        IngestFile *file = &files[i];
+        pthread_mutex_lock(&pipeline.lock);
+        while (file->head == NULL && !file->done) ingest_wait_block(ar, &pipeline);
+        bool unreadable = file->head == NULL && file->failed;
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if (unreadable) {
+            fprintf(stderr, options->error_format, file->filename);
+            if (options->stop_on_error) exit(1);
+            ok = false;
+            if (file->fd > 0) close(file->fd);
+            continue; // si ya estaba en el FAT conserva su contenido anterior
+        }
+
+        // si el archivo ya esta en el FAT su contenido se reemplaza: los bloques viejos quedan pendientes y
+        // se reusan recién cuando se confirme el journal_put de abajo, que ya tiene la versión nueva
+        FileEntry *entry = fat_find_or_add(&ar->fat, file->filename);
+        entry_release_blocks(ar, entry);
+        size_t file_size = ingest_write_file(ar, &pipeline, file, entry, jobs, options->very_verbose);
+        entry_set_metadata(ar, entry, &file->metadata);
+        journal_put(ar, entry);
+
+        if (file->failed) {
+            fprintf(stderr, options->error_format, file->filename);
+            if (options->stop_on_error) exit(1);
+            ok = false;
+        } else if (options->verbose) {
+            printf(options->done_format, file->filename, file_size);
+        }
+        if (file->fd > 0) close(file->fd);
+    }
+
+    io_free(&ar->io); // espera lo que quedó en vuelo, el resto del archivo empacado se escribe síncrono
+    io_init(&ar->io, 0);
+    for (size_t i = 0; i < started; i++) pthread_join(readers[i], NULL);
+    free(readers);
+    free(buffers);
+    buffer_put(packed_memory, num_buffers * LZ_BOUND(block_size));
+    buffer_put(buffer_memory, num_buffers * block_size);
+    pthread_cond_destroy(&pipeline.block_ready);
+    pthread_cond_destroy(&pipeline.buffer_returned);
+    pthread_mutex_destroy(&pipeline.lock);
+    return ok;
+}
+
+IngestFile *ingest_file_list(char **filenames, int num_files, int codec) {
+    IngestFile *files = xrealloc(NULL, (num_files + 1) * sizeof(IngestFile));
+    memset(files, 0, (num_files + 1) * sizeof(IngestFile));
+    for (int i = 0; i < num_files; i++) {
+        files[i].filename = filenames[i];
+        files[i].fd = -1; // lo abre el lector
+        files[i].codec = codec;
+    }
+    return files;
+}
+
+typedef struct {
+    IngestFile *files; // lo encontrado, en el orden en que lo agregan los hilos
+    size_t num_files;
+    size_t capacity;
+    char **queue; // directorios por recorrer, apuntan a los nombres de files
+    size_t queue_length;
+    size_t queue_capacity;
+    size_t busy; // hilos recorriendo un directorio
+    int codec;
+    const char *root; // el directorio nombrado en la línea de comandos, el único que se sigue si es un enlace
+    bool failed; // algun directorio o entrada no se pudo leer
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+} Walk;
+
+void walk_push(Walk *walk, const char *path) {
+    if (walk->queue_length == walk->queue_capacity) {
+        walk->queue_capacity = walk->queue_capacity ? walk->queue_capacity * 2 : 64;
+        walk->queue = xrealloc(walk->queue, walk->queue_capacity * sizeof(char *));
+    }
+    walk->queue[walk->queue_length++] = (char *)path;
+}
+
+void walk_directory(Walk *walk, const char *path) {
+    // los stat son relativos al directorio abierto: el kernel no vuelve a resolver la ruta para cada archivo
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | (path == walk->root ? 0 : O_NOFOLLOW));
+    DIR *dir = dir_fd >= 0 ? fdopendir(dir_fd) : NULL;
+    if (dir == NULL) {
+        fprintf(stderr, "Error al abrir el directorio %s\n", path);
+        if (dir_fd >= 0) close(dir_fd);
+        // sin su contenido no se guarda: quedaría un directorio vacío en lugar de lo que había
+        pthread_mutex_lock(&walk->lock);
+        walk->failed = true;
+        for (size_t i = walk->num_files; i > 0; i--) {
+            if (walk->files[i - 1].filename == path) walk->files[i - 1].failed = true;
+        }
+        pthread_mutex_unlock(&walk->lock);
+        return;
+    }
+
+    // se junta el directorio completo y se agrega de una vez, un solo candado por directorio
+    IngestFile *batch = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t path_length = strlen(path);
+    bool failed = false;
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+        struct stat st;
+        if (fstatat(dir_fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            fprintf(stderr, "Error al leer %s/%s\n", path, d->d_name);
+            failed = true;
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode) && !S_ISLNK(st.st_mode)) {
+            fprintf(stderr, "Se omite %s/%s: tipo de archivo no soportado\n", path, d->d_name);
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            batch = xrealloc(batch, capacity * sizeof(IngestFile));
+        }
+        size_t name_length = strlen(d->d_name);
+        char *name = xrealloc(NULL, path_length + name_length + 2);
+        memcpy(name, path, path_length);
+        name[path_length] = '/';
+        memcpy(name + path_length + 1, d->d_name, name_length + 1);
+        memset(&batch[count], 0, sizeof(IngestFile));
+        batch[count].filename = name;
+        batch[count].fd = -1;
+        batch[count].expected_size = S_ISREG(st.st_mode) ? st.st_size : 0;
+        batch[count].codec = walk->codec;
+        batch[count].metadata = metadata_from_stat(&st);
+        count++;
+    }
+    closedir(dir);
+
+    pthread_mutex_lock(&walk->lock);
+    walk->failed |= failed;
+    if (walk->num_files + count > walk->capacity) {
+        while (walk->num_files + count > walk->capacity) walk->capacity = walk->capacity ? walk->capacity * 2 : 1024;
+        walk->files = xrealloc(walk->files, walk->capacity * sizeof(IngestFile));
+    }
+    for (size_t i = 0; i < count; i++) {
+        walk->files[walk->num_files++] = batch[i];
+        if (S_ISDIR(batch[i].metadata.mode)) walk_push(walk, batch[i].filename);
+    }
+    pthread_cond_broadcast(&walk->work);
+    pthread_mutex_unlock(&walk->lock);
+    free(batch);
+}
+
+void *walk_worker(void *arg) {
+    // cada hilo toma el siguiente directorio pendiente; se termina cuando no hay ninguno y nadie está recorriendo
+    Walk *walk = arg;
+    pthread_mutex_lock(&walk->lock);
+    for (;;) {
+        while (walk->queue_length == 0 && walk->busy > 0) pthread_cond_wait(&walk->work, &walk->lock);
+        if (walk->queue_length == 0) break;
+        char *path = walk->queue[--walk->queue_length];
+        walk->busy++;
+        pthread_mutex_unlock(&walk->lock);
+        walk_directory(walk, path);
+        pthread_mutex_lock(&walk->lock);
+        walk->busy--;
+        pthread_cond_broadcast(&walk->work);
+    }
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+
+int compare_ingest_names(const void *a, const void *b) {
+    // orden de nombres: cada directorio queda antes que su contenido
+    return strcmp(((const IngestFile *)a)->filename, ((const IngestFile *)b)->filename);
+}
+
+IngestFile *ingest_walk(char **filenames, int num_files, int codec, int jobs, size_t *count, bool *failed) {
+    // los argumentos en su orden; cada directorio se recorre completo con varios hilos y su contenido se ordena
+    // por nombre, asi el archivo empacado no depende de que hilo llegó primero. Como los archivos nombrados, un
+    // directorio nombrado se sigue si es un enlace. failed queda en true si algo no se pudo recorrer
+    Walk walk;
+    memset(&walk, 0, sizeof(Walk));
+    walk.codec = codec;
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.work, NULL);
+
+    for (int i = 0; i < num_files; i++) {
+        struct stat st;
+        bool is_dir = stat(filenames[i], &st) == 0 && S_ISDIR(st.st_mode);
+        size_t length = strlen(filenames[i]);
+        while (is_dir && length > 1 && filenames[i][length - 1] == '/') length--;
+
+        if (walk.num_files == walk.capacity) {
+            walk.capacity = walk.capacity ? walk.capacity * 2 : 1024;
+            walk.files = xrealloc(walk.files, walk.capacity * sizeof(IngestFile));
+        }
+        IngestFile *file = &walk.files[walk.num_files++];
+        memset(file, 0, sizeof(IngestFile));
+        file->filename = strndup(filenames[i], length);
+        file->fd = -1; // un archivo nombrado se sigue si es un enlace y lo abre el lector
+        file->codec = codec;
+        if (!is_dir) continue;
+        file->metadata = metadata_from_stat(&st);
+
+        size_t first = walk.num_files;
+        walk.root = file->filename;
+        walk_push(&walk, file->filename);
+
+        size_t num_threads = jobs > 1 ? (size_t)jobs : 1;
+        pthread_t *threads = xrealloc(NULL, num_threads * sizeof(pthread_t));
+        size_t started = 1; // este hilo también recorre
+        while (started < num_threads && pthread_create(&threads[started], NULL, walk_worker, &walk) == 0) started++;
+        walk_worker(&walk);
+        for (size_t t = 1; t < started; t++) pthread_join(threads[t], NULL);
+        free(threads);
+        size_t kept = first - 1;
+        for (size_t f = first - 1; f < walk.num_files; f++) {
+            if (walk.files[f].failed) free((char *)walk.files[f].filename);
+            else walk.files[kept++] = walk.files[f];
+        }
+        walk.num_files = kept;
+        if (kept < first) continue; // el directorio nombrado no se pudo abrir
+        qsort(walk.files + first, walk.num_files - first, sizeof(IngestFile), compare_ingest_names);
+    }
+
+    pthread_cond_destroy(&walk.work);
+    pthread_mutex_destroy(&walk.lock);
+    free(walk.queue);
+    *count = walk.num_files;
+    *failed = walk.failed;
+    return walk.files != NULL ? walk.files : xrealloc(NULL, sizeof(IngestFile));
+}
+
+void ingest_free_walk(IngestFile *files, size_t count) {
+    for (size_t i = 0; i < count; i++) free((char *)files[i].filename);
+    free(files);
+}
+
+void create_archive(const char *archive_name, char **filenames, int num_files, int codec, bool dedup, size_t block_size, int jobs, bool verbose, bool very_verbose) {
+    if (verbose) printf("Creando archivo %s\n", archive_name);
+
+    Archive ar;
+    if (!archive_create(&ar, archive_name, block_size)) {
+        fprintf(stderr, "Error al abrir el archivo %s\n", archive_name);
+        exit(1);
+    }
+    if (dedup) dedup_enable(&ar);
+
+    if (codec < 0) codec = CODEC_NONE;
+    IngestOptions options = {true, "Error al abrir el archivo %s\n", "Tamaño del archivo %s: %zu bytes\n", verbose, very_verbose};
+    if (num_files > 0) {
+        // si se me pasan archivos; los directorios se recorren completos
+        size_t count;
+        bool walk_failed;
+        IngestFile *files = ingest_walk(filenames, num_files, codec, jobs, &count, &walk_failed);
+        if (walk_failed) exit(1); // como una entrada que no se puede abrir; el error ya se mostró
+        ingest_files(&ar, files, count, jobs, &options);
+        ingest_free_walk(files, count);
+    } else {
+        if (verbose) {
+            printf("Leyendo datos desde la entrada estándar (stdin)\n");
+        }
+
+        IngestFile input = {.filename = "stdin", .fd = STDIN_FILENO, .codec = codec};
+        ingest_files(&ar, &input, 1, jobs, &options);
+    }
+
+    dedup_report(&ar, verbose);
+    archive_close(&ar);
+}
+
+bool archive_map(Archive *ar) {
+    pthread_mutex_lock(&ar->map_lock);
+    if (ar->map == NULL) {
+        struct stat st;
+        if (fstat(fileno(ar->file), &st) == 0 && st.st_size > 0) {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(ar->file), 0);
+            if (map != MAP_FAILED) {
+                ar->map_length = st.st_size;
+                ar->map = map;
+            }
+        }
+    }
+    pthread_mutex_unlock(&ar->map_lock);
+    return ar->map != NULL;
+}
+
+bool copy_from_archive(Archive *ar, size_t position, int output_fd, size_t output_offset, size_t length) {
+    // primero copy_file_range: los datos van del archivo empacado a la salida dentro del kernel
+    loff_t offset = position;
+    loff_t out_offset = output_offset;
+    while (atomic_load(&ar->copy_file_range_ok) && length > 0) {
+        uint64_t start = stats_now();
+        size_t from = offset;
+        ssize_t copied = copy_file_range(fileno(ar->file), &offset, output_fd, &out_offset, length, 0);
+        if (copied > 0) {
+            stats_io(fileno(ar->file), from, copied, false, 0); // una copia dentro del kernel: lee y escribe
+            stats_io(output_fd, out_offset - copied, copied, true, start);
+            length -= copied;
+            continue;
+        }
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied == 0 || errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) {
+            atomic_store(&ar->copy_file_range_ok, false); // el sistema de archivos no lo soporta, usar la proyección
+            break;
+        }
+        return false;
+    }
+    if (length == 0) return true;
+
+    // respaldo: proyectar el archivo empacado y escribir directo desde la proyección
+    if (!archive_map(ar) || offset + length > ar->map_length) return false;
+    size_t page_offset = offset & (getpagesize() - 1);
+    madvise(ar->map + offset - page_offset, length + page_offset, MADV_SEQUENTIAL);
+    return pwrite_all(output_fd, ar->map + offset, length, out_offset);
+}
+
+bool stream_read_async(Archive *ar, IoEngine *io, IoBatch *batch, FileEntry *entry, size_t stream_offset, unsigned char *out, size_t length) {
+    // pedir un rango de los datos almacenados del archivo, que pueden cruzar de un extent al siguiente. Los errores
+    // de lectura quedan en batch; devuelve false si el rango se sale de los extents
+    stream_offset += entry->data_offset;
+    size_t extent_start = 0;
+    for (size_t j = 0; j < entry->num_extents && length > 0; j++) {
+        size_t extent_bytes = entry->extents[j].num_blocks * ar->sb.block_size;
+        while (stream_offset < extent_start + extent_bytes && length > 0) {
+            size_t in_extent = stream_offset - extent_start;
+            size_t n = extent_bytes - in_extent < length ? extent_bytes - in_extent : length;
+            if (n > IO_READ_SIZE) n = IO_READ_SIZE;
+            io_batch_read(io, batch, fileno(ar->file), out, n, entry->extents[j].position + in_extent);
+            out += n;
+            stream_offset += n;
+            length -= n;
+        }
+        extent_start += extent_bytes;
+    }
+    return length == 0;
+}
+
+bool stream_read(Archive *ar, FileEntry *entry, size_t stream_offset, unsigned char *out, size_t length) {
+    IoEngine io;
+    io_init(&io, 0);
+    IoBatch batch = {0};
+    return stream_read_async(ar, &io, &batch, entry, stream_offset, out, length) && !batch.failed;
+}
+
+bool extract_compressed_range(Archive *ar, FileEntry *entry, int output_fd, size_t first_block, size_t num_blocks, bool very_verbose) {
+    // cada bloque se comprimió por separado: se leen solo los bloques pedidos y se descomprimen uno por uno
+    size_t last_block = first_block + num_blocks < entry->num_frames ? first_block + num_blocks : entry->num_frames;
+    if (first_block >= last_block) return true;
+    size_t stored = entry->frame_offsets[last_block] - entry->frame_offsets[first_block];
+    size_t block_size = ar->sb.block_size;
+    unsigned char *packed = buffer_get(stored);
+    unsigned char *blocks = buffer_get(IO_EXTRACT_DEPTH * block_size);
+
+    // los pedidos de lectura van todos juntos y cada bloque descomprimido se escribe mientras se descomprime
+    // el siguiente; un solo bloque no justifica armar una cola
+    IoEngine io;
+    io_init(&io, last_block - first_block > 1 ? 2 * IO_EXTRACT_DEPTH : 0);
+    io_set_direct(&io, fileno(ar->file), ar->direct_fd);
+    IoBatch read = {0};
+    IoBatch writes[IO_EXTRACT_DEPTH + 1] = {{0}}; // uno por bloque de salida y el último para los bloques sin comprimir
+    bool ok = stream_read_async(ar, &io, &read, entry, entry->frame_offsets[first_block], packed, stored);
+    io_wait_batch(&io, &read);
+    ok = ok && !read.failed;
+    size_t next_slot = 0;
+    for (size_t i = first_block; ok && i < last_block; i++) {
+        uint32_t frame = entry->frames[i];
+        const unsigned char *source = packed + (entry->frame_offsets[i] - entry->frame_offsets[first_block]);
+        size_t length = entry->file_size - i * block_size < block_size ? entry->file_size - i * block_size : block_size;
+
+        if (frame == FRAME_HOLE) continue; // la salida ya tiene el tamaño final: lo que no se escribe queda como hueco
+        IoBatch *batch = &writes[IO_EXTRACT_DEPTH];
+        if (frame & FRAME_RAW) {
+            ok = (frame & FRAME_SIZE_MASK) == length;
+        } else {
+            size_t slot = next_slot++ % IO_EXTRACT_DEPTH;
+            batch = &writes[slot];
+            io_wait_batch(&io, batch); // la escritura anterior desde este lugar
+            unsigned char *block = blocks + slot * block_size;
+            ok = !batch->failed && codecs[entry->codec].decompress(source, frame & FRAME_SIZE_MASK, block, length);
+            source = block;
+        }
+        if (ok && entry->num_hashes > 0 && hash_block(source, length) != entry->hashes[i]) {
+            // los datos ya pasaron por memoria, comprobarlos no cuesta otra lectura
+            fprintf(stderr, "Bloque %zu del archivo %s dañado\n", i + 1, entry->filename);
+            ok = false;
+        }
+        if (ok) io_batch_write(&io, batch, output_fd, source, length, i * block_size);
+    }
+    io_free(&io);
+    for (size_t i = 0; i <= IO_EXTRACT_DEPTH; i++) ok = ok && !writes[i].failed;
+
+    if (ok && very_verbose) {
+        printf("Bloques %zu a %zu del archivo %s descomprimidos (%s, %zu bytes almacenados)\n", first_block + 1, last_block, entry->filename,
+               codecs[entry->codec].name, stored);
+    }
+    buffer_put(blocks, IO_EXTRACT_DEPTH * block_size);
+    buffer_put(packed, stored);
+    return ok;
+}
+
+bool extract_range(Archive *ar, FileEntry *entry, int output_fd, size_t first_block, size_t num_blocks, bool very_verbose) {
+    // copiar los bloques [first_block, first_block + num_blocks) a su misma posición en la salida,
+    // un extent a la vez sin pasar por un bloque intermedio ni leer el relleno del ultimo bloque
+    size_t block_size = ar->sb.block_size;
+    size_t output_offset = first_block * block_size;
+    if (output_offset >= entry->file_size) return true;
+    size_t length = num_blocks * block_size;
+    if (length > entry->file_size - output_offset) length = entry->file_size - output_offset;
+
+    size_t stream_offset = output_offset + entry->data_offset;
+    size_t extent_start = 0;
+    for (size_t j = 0; j < entry->num_extents && length > 0; j++) {
+        size_t extent_bytes = entry->extents[j].num_blocks * ar->sb.block_size;
+        if (stream_offset < extent_start + extent_bytes) {
+            size_t position = entry->extents[j].position + (stream_offset - extent_start);
+            size_t n = extent_start + extent_bytes - stream_offset < length ? extent_start + extent_bytes - stream_offset : length;
+            if (!copy_from_archive(ar, position, output_fd, output_offset, n)) return false;
+
+            if (very_verbose) {
+                printf("Bloques %zu a %zu del archivo %s extraídos de la posición %zu\n", output_offset / block_size + 1,
+                       blocks_for(output_offset + n, block_size), entry->filename, position);
+            }
+            output_offset += n;
+            stream_offset += n;
+            length -= n;
+        }
+        extent_start += extent_bytes;
+    }
+    return length == 0;
+}
+
+size_t select_members(Archive *ar, char **patterns, int num_patterns, FileEntry **selected, bool *missing) {
+    // sin nombres se extrae todo; un nombre exacto se busca en la tabla del índice sin recorrerlo
+    // y solo los patrones (*, ?, [...]) se comparan contra cada archivo
+    bool *chosen = calloc(ar->fat.num_files + 1, sizeof(bool));
+    if (chosen == NULL) {
+        fprintf(stderr, "Error: memoria insuficiente\n");
+        exit(1);
+    }
+    for (int p = 0; p < num_patterns; p++) {
+        bool found = false;
+        FileEntry *entry = fat_find(&ar->fat, patterns[p]);
+        if (entry != NULL) {
+            chosen[entry - ar->fat.files] = true;
+            found = true;
+        } else if (strpbrk(patterns[p], "*?[") != NULL) {
+            for (size_t i = 0; i < ar->fat.num_files; i++) {
+                if (!ar->fat.files[i].deleted && fnmatch(patterns[p], ar->fat.files[i].filename, 0) == 0) {
+                    chosen[i] = true;
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Archivo '%s' no encontrado en el archivo empacado.\n", patterns[p]);
+            *missing = true;
+        }
+    }
+
+    // en el orden del archivo empacado, cada uno una sola vez aunque varios patrones lo nombren
+    size_t count = 0;
+    for (size_t i = 0; i < ar->fat.num_files; i++) {
+        if (!ar->fat.files[i].deleted && (num_patterns == 0 || chosen[i])) selected[count++] = &ar->fat.files[i];
+    }
+    free(chosen);
+    return count;
+}
+
+bool send_from_archive(Archive *ar, size_t position, int output_fd, size_t length) {
+    // sendfile copia dentro del kernel y sirve para tuberías, que copy_file_range no acepta
+    off_t offset = position;
+    while (length > 0) {
+        uint64_t start = stats_now();
+        ssize_t sent = sendfile(output_fd, fileno(ar->file), &offset, length);
+        if (sent > 0) {
+            stats_io(fileno(ar->file), offset - sent, sent, false, 0);
+            stats_io(output_fd, (size_t)-1, sent, true, start);
+            length -= sent;
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent == 0 || errno == EINVAL || errno == ENOSYS) break;
+        return false;
+    }
+
+    // respaldo: leer y escribir de a trozos grandes
+    size_t buffer_size = length < STDOUT_WRITE_SIZE ? length : STDOUT_WRITE_SIZE;
+    unsigned char *buffer = buffer_get(buffer_size);
+    bool ok = true;
+    while (ok && length > 0) {
+        size_t n = length < STDOUT_WRITE_SIZE ? length : STDOUT_WRITE_SIZE;
+        ok = pread_all(fileno(ar->file), buffer, n, offset) && write_all(output_fd, buffer, n);
+        offset += n;
+        length -= n;
+    }
+    buffer_put(buffer, buffer_size);
+    return ok;
+}
+
+bool stream_member(Archive *ar, FileEntry *entry, int output_fd) {
+    // escribir el contenido de un archivo en orden a una salida sin posiciones (tubería, terminal)
+    size_t block_size = ar->sb.block_size;
+    if (entry->num_frames == 0) {
+        size_t stream_offset = entry->data_offset;
+        size_t length = entry->file_size;
+        size_t extent_start = 0;
+        for (size_t j = 0; j < entry->num_extents && length > 0; j++) {
+            size_t extent_bytes = entry->extents[j].num_blocks * block_size;
+            if (stream_offset < extent_start + extent_bytes) {
+                size_t n = extent_start + extent_bytes - stream_offset < length ? extent_start + extent_bytes - stream_offset : length;
+                if (!send_from_archive(ar, entry->extents[j].position + (stream_offset - extent_start), output_fd, n)) return false;
+                stream_offset += n;
+                length -= n;
+            }
+            extent_start += extent_bytes;
+        }
+        return length == 0;
+    }
+
+    // comprimido o con huecos: se lee un grupo de bloques, se descomprime a un buffer y se escribe de una vez
+    size_t group_blocks = blocks_in(STDOUT_WRITE_SIZE, block_size);
+    unsigned char *packed = buffer_get(group_blocks * block_size);
+    unsigned char *out = buffer_get(group_blocks * block_size);
+    bool ok = true;
+    for (size_t first = 0; ok && first < entry->num_frames; first += group_blocks) {
+        size_t last = first + group_blocks < entry->num_frames ? first + group_blocks : entry->num_frames;
+        size_t stored = entry->frame_offsets[last] - entry->frame_offsets[first];
+        ok = stream_read(ar, entry, entry->frame_offsets[first], packed, stored);
+        size_t out_length = 0;
+        for (size_t i = first; ok && i < last; i++) {
+            uint32_t frame = entry->frames[i];
+            const unsigned char *source = packed + (entry->frame_offsets[i] - entry->frame_offsets[first]);
+            size_t length = entry->file_size - i * block_size < block_size ? entry->file_size - i * block_size : block_size;
+            if (frame == FRAME_HOLE) {
+                memset(out + out_length, 0, length);
+                out_length += length;
+                continue;
+            }
+            if (frame & FRAME_RAW) {
+                ok = (frame & FRAME_SIZE_MASK) == length;
+                memcpy(out + out_length, source, length);
+            } else {
+                ok = codecs[entry->codec].decompress(source, frame & FRAME_SIZE_MASK, out + out_length, length);
+            }
+            if (ok && entry->num_hashes > 0 && hash_block(out + out_length, length) != entry->hashes[i]) {
+                fprintf(stderr, "Bloque %zu del archivo %s dañado\n", i + 1, entry->filename);
+                ok = false;
+            }
+            out_length += length;
+        }
+        ok = ok && write_all(output_fd, out, out_length);
+    }
+    buffer_put(out, group_blocks * block_size);
+    buffer_put(packed, group_blocks * block_size);
+    return ok;
+}
+
+const char *extract_path(const char *name) {
+    // los nombres se extraen debajo del directorio actual: como tar se quitan los '/' y "../" del inicio,
+    // y un ".." en el medio lo descarta
+    while (*name == '/' || strncmp(name, "../", 3) == 0) name += *name == '/' ? 1 : 3;
+    for (const char *p = name; *p; ) {
+        const char *end = strchrnul(p, '/');
+        if (end - p == 2 && p[0] == '.' && p[1] == '.') return NULL;
+        p = *end ? end + 1 : end;
+    }
+    return *name ? name : NULL;
+}
+
+void close_parent(int dir) {
+    if (dir != AT_FDCWD) close(dir);
+}
+
+int extract_parent(const char *path, const char **leaf) {
+    // abrir el directorio que contiene path creando los que faltan (como mkdir -p) sin seguir enlaces: un
+    // enlace extraído antes no puede llevar lo que sigue fuera del directorio actual. Devuelve -1 si falla
+    int dir = AT_FDCWD;
+    const char *component = path;
+    for (const char *slash; (slash = strchr(component, '/')) != NULL; component = slash + 1) {
+        size_t length = slash - component;
+        if (length == 0) continue;
+        char name[NAME_MAX + 1];
+        int next = -1;
+        if (length <= NAME_MAX) {
+            memcpy(name, component, length);
+            name[length] = '\0';
+            next = openat(dir, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (next < 0 && errno == ENOENT && (mkdirat(dir, name, 0755) == 0 || errno == EEXIST)) {
+                next = openat(dir, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            }
+        }
+        close_parent(dir);
+        if (next < 0) return -1;
+        dir = next;
+    }
+    *leaf = component;
+    return dir;
+}
+
+bool is_symlink_at(int dir, const char *name) {
+    struct stat st;
+    return fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode);
+}
+
+int extract_open(const char *path) {
+    // el archivo de salida tampoco puede ser un enlace: O_NOFOLLOW falla en vez de escribir a donde apunta
+    const char *leaf;
+    int dir = extract_parent(path, &leaf);
+    if (dir == -1) return -1;
+    int fd = openat(dir, leaf, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+    close_parent(dir);
+    return fd;
+}
+
+void restore_metadata(int fd, const char *path, const EntryMetadata *metadata) {
+    // con fd se aplica al archivo abierto, si no a la ruta sin seguir enlaces; el dueño solo si somos root
+    if (metadata->mode == 0) return;
+    struct timespec times[2] = {{0, UTIME_OMIT}, {metadata->mtime, metadata->mtime_nsec}};
+    if (path == NULL) {
+        if (geteuid() == 0) fchown(fd, metadata->uid, metadata->gid);
+        fchmod(fd, metadata->mode & 07777);
+        futimens(fd, times);
+        return;
+    }
+    if (geteuid() == 0) fchownat(fd, path, metadata->uid, metadata->gid, AT_SYMLINK_NOFOLLOW);
+    if (!S_ISLNK(metadata->mode)) fchmodat(fd, path, metadata->mode & 07777, 0);
+    utimensat(fd, path, times, AT_SYMLINK_NOFOLLOW);
+}
+
+bool extract_symlink(Archive *ar, FileEntry *entry, int dir, const char *leaf, const char *path) {
+    // el destino es el contenido del archivo y siempre entra en un bloque
+    char target[MIN_BLOCK_SIZE + 1];
+    bool ok = entry->file_size < sizeof(target) && entry->num_extents > 0;
+    if (ok && entry->num_frames == 0) {
+        ok = stream_read(ar, entry, 0, (unsigned char *)target, entry->file_size);
+    } else if (ok) {
+        unsigned char stored[MIN_BLOCK_SIZE];
+        size_t stored_length = entry->frames[0] & FRAME_SIZE_MASK;
+        ok = stored_length <= sizeof(stored) && stream_read(ar, entry, 0, stored, stored_length);
+        if (ok && (entry->frames[0] & FRAME_RAW)) memcpy(target, stored, entry->file_size);
+        else ok = ok && codecs[entry->codec].decompress(stored, stored_length, (unsigned char *)target, entry->file_size);
+    }
+    if (ok) {
+        target[entry->file_size] = '\0';
+        unlinkat(dir, leaf, 0); // como tar: el enlace reemplaza lo que hubiera con ese nombre
+        ok = symlinkat(target, dir, leaf) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error al crear el enlace %s\n", path);
+        return false;
+    }
+    restore_metadata(dir, leaf, &entry->metadata);
+    return true;
+}
+
+typedef struct {
+    size_t member; // archivo al que pertenece el trozo
+    size_t first_block;
+    size_t num_blocks;
+} ExtractTask;
+
+typedef struct {
+    FileEntry *entry;
+    const char *path;
+    int fd; // -1 hasta su primer trozo, se cierra al terminar el último
+    bool open_failed;
+    atomic_size_t pending_tasks;
+    atomic_bool failed; // los resultados se reportan en orden al final
+} ExtractOutput;
+
+typedef struct {
+    Archive *ar;
+    ExtractOutput *outputs;
+    pthread_mutex_t open_lock;
+    ExtractTask *tasks;
+    bool very_verbose;
+} ExtractJob;
+
+int extract_output_fd(ExtractJob *job, ExtractOutput *output) {
+    // las tareas salen en orden, así que quedan abiertas unas pocas salidas más que hilos y no todas a la vez
+    pthread_mutex_lock(&job->open_lock);
+    if (output->fd < 0 && !output->open_failed) {
+        output->fd = extract_open(output->path);
+        output->open_failed = output->fd < 0;
+        if (output->fd >= 0) {
+            ftruncate(output->fd, output->entry->file_size); // los trozos se escriben con pwrite en su posición
+            stats_count(&stats.truncates, 1);
+        }
+    }
+    int fd = output->fd;
+    pthread_mutex_unlock(&job->open_lock);
+    return fd;
+}
+
+void extract_task(void *context, size_t task) {
+    ExtractJob *job = context;
+    ExtractTask *t = &job->tasks[task];
+    ExtractOutput *output = &job->outputs[t->member];
+    FileEntry *entry = output->entry;
+    int fd = extract_output_fd(job, output);
+    bool ok = fd >= 0 && (entry->num_frames == 0
+        ? extract_range(job->ar, entry, fd, t->first_block, t->num_blocks, job->very_verbose)
+        : extract_compressed_range(job->ar, entry, fd, t->first_block, t->num_blocks, job->very_verbose));
+    if (!ok) {
+        atomic_store(&output->failed, true);
+    }
+    if (atomic_fetch_sub(&output->pending_tasks, 1) == 1 && fd >= 0) {
+        restore_metadata(fd, NULL, &entry->metadata);
+        close(fd);
+    }
+}
+
+bool extract_archive(const char *archive_name, char **filenames, int num_files, bool to_stdout, int jobs, bool verbose, bool very_verbose) {
+    Archive ar;
+    if (!archive_open(&ar, archive_name, false)) return false;
+
+    FileEntry **selected = xrealloc(NULL, (ar.fat.num_files + 1) * sizeof(FileEntry *));
+    bool missing = false;
+    size_t num_selected = select_members(&ar, filenames, num_files, selected, &missing);
+
+    if (to_stdout) {
+        // uno tras otro en orden; los mensajes van a stderr para no mezclarse con los datos
+        bool ok = !missing;
+        for (size_t m = 0; m < num_selected; m++) {
+            if (S_ISDIR(selected[m]->metadata.mode) || S_ISLNK(selected[m]->metadata.mode)) continue; // solo contenido
+            if (verbose) fprintf(stderr, "Extrayendo archivo: %s\n", selected[m]->filename);
+            if (!stream_member(&ar, selected[m], STDOUT_FILENO)) {
+                fprintf(stderr, "Error al extraer el archivo %s\n", selected[m]->filename);
+                ok = false;
+                break; // lo que siga ya no estaría en su lugar en la salida
+            }
+        }
+        free(selected);
+        archive_close(&ar);
+        return ok;
+    }
+
+    ExtractOutput *outputs = xrealloc(NULL, (num_selected + 1) * sizeof(ExtractOutput));
+    size_t split_blocks = blocks_in(EXTRACT_SPLIT_SIZE, ar.sb.block_size);
+    size_t num_tasks = 0;
+    bool ok = !missing;
+
+    // partir los archivos grandes en trozos independientes, cada salida se abre con su primer trozo; los
+    // directorios y enlaces se crean aquí mismo
+    size_t num_members = 0;
+    FileEntry **directories = xrealloc(NULL, (num_selected + 1) * sizeof(FileEntry *));
+    size_t num_directories = 0;
+    for (size_t i = 0; i < num_selected; i++) {
+        FileEntry *entry = selected[i];
+        const char *path = extract_path(entry->filename);
+        if (path == NULL) {
+            fprintf(stderr, "Se omite '%s': la ruta sale del directorio actual\n", entry->filename);
+            ok = false;
+            continue;
+        }
+        const char *leaf;
+        int dir = extract_parent(path, &leaf);
+        if (dir == -1) {
+            fprintf(stderr, "Error al crear el archivo de salida: %s\n", entry->filename);
+            ok = false;
+            continue;
+        }
+        if (S_ISDIR(entry->metadata.mode)) {
+            if (verbose) printf("Creando directorio: %s\n", path);
+            if (is_symlink_at(dir, leaf)) unlinkat(dir, leaf, 0); // un enlace con ese nombre se reemplaza
+            if (mkdirat(dir, leaf, 0700) != 0 && errno != EEXIST) {
+                fprintf(stderr, "Error al crear el directorio %s\n", path);
+                ok = false;
+            }
+            close_parent(dir);
+            directories[num_directories++] = entry; // sus permisos y fecha se aplican al final, despues de llenarlo
+            continue;
+        }
+        if (S_ISLNK(entry->metadata.mode)) {
+            if (verbose) printf("Creando enlace: %s\n", path);
+            ok &= extract_symlink(&ar, entry, dir, leaf, path);
+            close_parent(dir);
+            continue;
+        }
+        // el contenido se escribe despues; un enlace anterior con el mismo nombre se reemplaza ahora, y si
+        // un miembro posterior vuelve a poner un enlace la apertura sin seguirlo falla
+        if (is_symlink_at(dir, leaf)) unlinkat(dir, leaf, 0);
+        close_parent(dir);
+
+        if (verbose) {
+            printf("Extrayendo archivo: %s\n", entry->filename);
+        }
+
+        ExtractOutput *output = &outputs[num_members++];
+        size_t total_blocks = blocks_for(entry->file_size, ar.sb.block_size);
+        size_t member_tasks = total_blocks == 0 ? 1 : (total_blocks + split_blocks - 1) / split_blocks;
+        *output = (ExtractOutput){.entry = entry, .path = path, .fd = -1};
+        atomic_init(&output->pending_tasks, member_tasks);
+        atomic_init(&output->failed, false);
+        num_tasks += member_tasks;
+    }
+    fflush(stdout);
+
+    ExtractTask *tasks = xrealloc(NULL, (num_tasks + 1) * sizeof(ExtractTask));
+    num_tasks = 0;
+    for (size_t m = 0; m < num_members; m++) {
+        size_t total_blocks = blocks_for(outputs[m].entry->file_size, ar.sb.block_size);
+        size_t first_block = 0;
+        do {
+            size_t num_blocks = total_blocks - first_block;
+            if (num_blocks > split_blocks) num_blocks = split_blocks;
+            tasks[num_tasks++] = (ExtractTask){m, first_block, num_blocks};
+            first_block += num_blocks;
+        } while (first_block < total_blocks);
+    }
+
+    ExtractJob job = {.ar = &ar, .outputs = outputs, .tasks = tasks, .very_verbose = very_verbose};
+    pthread_mutex_init(&job.open_lock, NULL);
+    run_parallel(extract_task, &job, num_tasks, jobs);
+    pthread_mutex_destroy(&job.open_lock);
+
+    for (size_t m = 0; m < num_members; m++) {
+        if (outputs[m].open_failed) {
+            fprintf(stderr, "Error al crear el archivo de salida: %s\n", outputs[m].entry->filename);
+            ok = false;
+        } else if (atomic_load(&outputs[m].failed)) {
+            fprintf(stderr, "Error al extraer el archivo %s\n", outputs[m].entry->filename);
+            ok = false;
+        }
+    }
+    // de adentro hacia afuera, así crear un subdirectorio no cambia la fecha del que lo contiene
+    for (size_t d = num_directories; d > 0; d--) {
+        const char *leaf;
+        int dir = extract_parent(extract_path(directories[d - 1]->filename), &leaf);
+        if (dir == -1) continue;
+        if (!is_symlink_at(dir, leaf)) restore_metadata(dir, leaf, &directories[d - 1]->metadata);
+        close_parent(dir);
+    }
+    free(directories);
+
+    free(tasks);
+    free(outputs);
+    free(selected);
+    archive_close(&ar);
+    return ok;
+}
+
+size_t stream_position(Archive *ar, FileEntry *entry, size_t stream_offset) {
+    // posición en el archivo empacado de un byte de los datos almacenados
+    stream_offset += entry->data_offset;
+    for (size_t j = 0; j < entry->num_extents; j++) {
+        size_t extent_bytes = entry->extents[j].num_blocks * ar->sb.block_size;
+        if (stream_offset < extent_bytes) return entry->extents[j].position + stream_offset;
+        stream_offset -= extent_bytes;
+    }
+    return 0;
+}
+
+typedef struct {
+    size_t member;
+    size_t first_block;
+    size_t num_blocks;
+    size_t position; // donde empiezan sus datos, las tareas se reparten en ese orden para leer el disco de corrido
+} VerifyTask;
+
+typedef struct {
+    Archive *ar;
+    FileEntry **entries;
+    atomic_size_t *bad_blocks; // por archivo
+    atomic_size_t *first_bad;
+    atomic_bool *unreadable;
+    VerifyTask *tasks;
+} VerifyJob;
+
+int compare_verify_tasks(const void *a, const void *b) {
+    size_t x = ((const VerifyTask *)a)->position;
+    size_t y = ((const VerifyTask *)b)->position;
+    return (x > y) - (x < y);
+}
+
+void verify_task(void *context, size_t task) {
+    // leer los datos almacenados de un trozo del archivo en lecturas grandes y comparar el hash de cada bloque
+    VerifyJob *job = context;
+    VerifyTask *t = &job->tasks[task];
+    Archive *ar = job->ar;
+    FileEntry *entry = job->entries[t->member];
+    size_t block_size = ar->sb.block_size;
+    size_t chunk_blocks = blocks_in(VERIFY_READ_SIZE, block_size);
+    unsigned char *stored = buffer_get(chunk_blocks * block_size); // un bloque comprimido nunca ocupa mas que el original
+    unsigned char *block = buffer_get(block_size);
+
+    size_t end_block = t->first_block + t->num_blocks;
+    for (size_t first = t->first_block; first < end_block; first += chunk_blocks) {
+        size_t last = first + chunk_blocks < end_block ? first + chunk_blocks : end_block;
+        bool compressed = entry->num_frames > 0; // o con huecos, que tambien ubica los bloques por frame_offsets
+        size_t stream_offset = compressed ? entry->frame_offsets[first] : first * block_size;
+        size_t stream_end = compressed ? entry->frame_offsets[last] : (last * block_size < entry->file_size ? last * block_size : entry->file_size);
+        if (!stream_read(ar, entry, stream_offset, stored, stream_end - stream_offset)) {
+            atomic_store(&job->unreadable[t->member], true);
+            break;
+        }
+
+        for (size_t i = first; i < last; i++) {
+            size_t length = entry->file_size - i * block_size < block_size ? entry->file_size - i * block_size : block_size;
+            const unsigned char *data = stored + (compressed ? entry->frame_offsets[i] - stream_offset : (i - first) * block_size);
+            bool ok = true;
+            if (compressed && entry->frames[i] == FRAME_HOLE) continue; // no hay nada guardado que se pueda dañar
+            if (compressed && (entry->frames[i] & FRAME_RAW)) {
+                ok = (entry->frames[i] & FRAME_SIZE_MASK) == length;
+            } else if (compressed) {
+                ok = codecs[entry->codec].decompress(data, entry->frames[i] & FRAME_SIZE_MASK, block, length);
+                data = block;
+            }
+            if (ok && hash_block(data, length) == entry->hashes[i]) continue;
+
+            atomic_fetch_add(&job->bad_blocks[t->member], 1);
+            size_t first_bad = atomic_load(&job->first_bad[t->member]);
+            while (i < first_bad && !atomic_compare_exchange_weak(&job->first_bad[t->member], &first_bad, i)) {}
+        }
+    }
+    buffer_put(block, block_size);
+    buffer_put(stored, chunk_blocks * block_size);
+}
+
+bool verify_archive(const char *archive_name, int jobs, bool verbose) {
+    Archive ar;
+    if (!archive_open(&ar, archive_name, false)) return false;
+    posix_fadvise(fileno(ar.file), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    size_t num_members = ar.fat.num_files - ar.fat.num_deleted;
+    FileEntry **entries = xrealloc(NULL, (num_members + 1) * sizeof(FileEntry *));
+    atomic_size_t *bad_blocks = xrealloc(NULL, (num_members + 1) * sizeof(atomic_size_t));
+    atomic_size_t *first_bad = xrealloc(NULL, (num_members + 1) * sizeof(atomic_size_t));
+    atomic_bool *unreadable = xrealloc(NULL, (num_members + 1) * sizeof(atomic_bool));
+    size_t split_blocks = blocks_in(EXTRACT_SPLIT_SIZE, ar.sb.block_size);
+    size_t num_tasks = 0;
+    size_t unchecked = 0;
+
+    // los archivos de versiones anteriores no tienen hashes y no se pueden comprobar
+    num_members = 0;
+    for (size_t i = 0; i < ar.fat.num_files; i++) {
+        FileEntry *entry = &ar.fat.files[i];
+        if (entry->deleted) continue;
+        if (entry->num_hashes == 0 && entry->file_size > 0) {
+            if (verbose) printf("Archivo '%s' sin checksums, no se comprueba.\n", entry->filename);
+            unchecked++;
+            continue;
+        }
+        entries[num_members] = entry;
+        atomic_init(&bad_blocks[num_members], 0);
+        atomic_init(&first_bad[num_members], (size_t)-1);
+        atomic_init(&unreadable[num_members], false);
+        num_tasks += blocks_for(entry->file_size, ar.sb.block_size) / split_blocks + 1;
+        num_members++;
+    }
+
+    VerifyTask *tasks = xrealloc(NULL, (num_tasks + 1) * sizeof(VerifyTask));
+    num_tasks = 0;
+    for (size_t m = 0; m < num_members; m++) {
+        FileEntry *entry = entries[m];
+        size_t total_blocks = blocks_for(entry->file_size, ar.sb.block_size);
+        for (size_t first_block = 0; first_block < total_blocks; first_block += split_blocks) {
+            size_t num_blocks = total_blocks - first_block < split_blocks ? total_blocks - first_block : split_blocks;
+            size_t stream_offset = entry->num_frames > 0 ? entry->frame_offsets[first_block] : first_block * ar.sb.block_size;
+            tasks[num_tasks++] = (VerifyTask){m, first_block, num_blocks, stream_position(&ar, entry, stream_offset)};
+        }
+    }
+    qsort(tasks, num_tasks, sizeof(VerifyTask), compare_verify_tasks);
+
+    VerifyJob job = {&ar, entries, bad_blocks, first_bad, unreadable, tasks};
+    run_parallel(verify_task, &job, num_tasks, jobs);
+
+    size_t damaged = 0;
+    for (size_t m = 0; m < num_members; m++) {
+        if (atomic_load(&unreadable[m])) {
+            fprintf(stderr, "Error al leer el archivo '%s'\n", entries[m]->filename);
+            damaged++;
+        } else if (atomic_load(&bad_blocks[m]) > 0) {
+            fprintf(stderr, "Archivo '%s' dañado: %zu bloques no coinciden (el primero es el bloque %zu).\n", entries[m]->filename,
+                    (size_t)atomic_load(&bad_blocks[m]), (size_t)atomic_load(&first_bad[m]) + 1);
+            damaged++;
+        } else if (verbose) {
+            printf("Archivo '%s' correcto.\n", entries[m]->filename);
+        }
+    }
+    printf("Verificación: %zu archivos correctos, %zu dañados, %zu sin checksums.\n", num_members - damaged, damaged, unchecked);
+
+    free(tasks);
+    free(unreadable);
+    free(first_bad);
+    free(bad_blocks);
+    free(entries);
+    archive_close(&ar);
+    return damaged == 0;
+}
+
+void delete_files_from_archive(const char *archive_name, char **filenames, int num_files, bool verbose, bool very_verbose) {
+    Archive ar;
+    if (!archive_open(&ar, archive_name, true)) return;
+
+    for (int i = 0; i < num_files; i++) {
+        const char *filename = filenames[i]; // conseguir el nombre del archivo a borrar
+        FileEntry *entry = fat_find(&ar.fat, filename);
+
+        if (entry == NULL) {
+            fprintf(stderr, "Archivo '%s' no encontrado en el archivo empacado.\n", filename);
+            continue;
+        }
+
+        // Marcar los bloques como libres
+        if (very_verbose) {
+            for (size_t k = 0; k < entry->num_extents; k++) {
+                printf("Bloques %zu a %zu del archivo '%s' marcados como libres.\n", entry->extents[k].position,
+                       entry->extents[k].position + (entry->extents[k].num_blocks - 1) * ar.sb.block_size, filename);
+            }
+        }
+        entry_release_blocks(&ar, entry);
+
+        // Eliminar la entrada del archivo del FAT
+        fat_remove(&ar.fat, entry);
+        journal_delete(&ar, filename);
+
+        if (verbose) {
+            printf("Archivo '%s' eliminado del archivo empacado.\n", filename);
+        }
+    }
+
+    // Confirmar los cambios en el registro
+    archive_close(&ar);
+}
+
+void release_old_blocks(Archive *ar, size_t *positions, bool *kept, size_t num_blocks) {
+    // los que ya no se usan, juntando los contiguos
+    size_t block_size = ar->sb.block_size;
+    for (size_t i = 0; i < num_blocks; ) {
+        if (kept[i]) {
+            i++;
+            continue;
+        }
+        size_t run = 1;
+        while (i + run < num_blocks && !kept[i + run] && positions[i + run] == positions[i] + run * block_size) run++;
+        archive_release(ar, positions[i], run);
+        i += run;
+    }
+}
+
+size_t update_blocks(Archive *ar, FileEntry *entry, int fd, const EntryMetadata *metadata, bool very_verbose) {
+    // copia en escritura: los bloques cuyo hash no cambió se siguen usando donde están y solo los distintos se
+    // escriben en bloques nuevos. Los viejos se sueltan recién cuando el registro confirma la entrada nueva, y
+    // los metadatos nuevos se aplican junto con ella; si la lectura falla la entrada queda como estaba
+    size_t block_size = ar->sb.block_size;
+    size_t num_old = entry->num_blocks;
+    size_t *old_positions = xrealloc(NULL, (num_old + 1) * sizeof(size_t));
+    bool *kept = calloc(num_old + 1, sizeof(bool));
+    size_t count = 0;
+    for (size_t j = 0; j < entry->num_extents; j++) {
+        for (size_t k = 0; k < entry->extents[j].num_blocks; k++) old_positions[count++] = entry->extents[j].position + k * block_size;
+    }
+
+    struct stat st;
+    size_t expected_size = fstat(fd, &st) == 0 ? st.st_size : 0;
+    unsigned char *data = buffer_get(block_size);
+    FileEntry updated = {0};
+    FileEntry written = {0}; // bloques nuevos, para devolverlos si la lectura falla
+    StreamWriter writer = {0};
+    size_t num_written = 0;
+    ssize_t length;
+    for (size_t i = 0; (length = read_block(fd, data, block_size)) > 0; i++) {
+        uint64_t hash = hash_block(data, length);
+        size_t old_length = i + 1 < num_old ? block_size : entry->file_size - i * block_size;
+        size_t position;
+        bool tracked = ar->sb.flags & SB_DEDUP;
+        if (i < num_old && (size_t)length == old_length && entry->hashes[i] == hash) {
+            position = old_positions[i];
+            kept[i] = true;
+            if (tracked) block_table_find(&ar->block_refs, position)->refs++; // la versión vieja suelta la suya al final
+        } else if (ar->dedup && (position = dedup_find(ar, data, length, hash)) != (size_t)-1) {
+            // mismo contenido que otro bloque guardado
+        } else {
+            // la reserva se duplica con cada corrida que se llena, sin pasarse de lo que falta leer
+            size_t wanted = num_written + 1;
+            size_t remaining = expected_size > updated.file_size ? blocks_for(expected_size - updated.file_size, block_size) : 1;
+            position = stream_write(ar, &written, &writer, data, length, wanted < remaining ? wanted : remaining, NULL);
+            num_written++;
+            if (tracked) block_add(ar, position, hash);
+            TRACE_BLOCK(very_verbose, "Bloque %zu del archivo '%s' escrito en la posición %zu\n", i + 1, entry->filename, position);
+        }
+        entry_add_blocks(&updated, position, 1, block_size);
+        entry_add_hash(&updated, hash);
+        updated.file_size += length;
+    }
+    stream_finish(ar, &writer);
+
+    if (length < 0) {
+        if (ar->sb.flags & SB_DEDUP) {
+            // cada bloque de la versión nueva tiene su referencia, soltarlas deja todo como estaba
+            for (size_t j = 0; j < updated.num_extents; j++) {
+                for (size_t k = 0; k < updated.extents[j].num_blocks; k++) block_unref(ar, updated.extents[j].position + k * block_size);
+            }
+        } else {
+            for (size_t j = 0; j < written.num_extents; j++) allocator_free(&ar->alloc, written.extents[j].position, written.extents[j].num_blocks);
+        }
+        free(updated.extents);
+        free(updated.hashes);
+        num_written = (size_t)-1;
+    } else {
+        if (ar->sb.flags & SB_DEDUP) {
+            for (size_t i = 0; i < num_old; i++) block_unref(ar, old_positions[i]);
+        } else {
+            release_old_blocks(ar, old_positions, kept, num_old);
+        }
+        free(entry->extents);
+        free(entry->hashes);
+        entry->extents = updated.extents;
+        entry->num_extents = updated.num_extents;
+        entry->extents_capacity = updated.extents_capacity;
+        entry->num_blocks = updated.num_blocks;
+        entry->hashes = updated.hashes;
+        entry->num_hashes = updated.num_hashes;
+        entry->hashes_capacity = updated.hashes_capacity;
+        entry->file_size = updated.file_size;
+        entry_set_metadata(ar, entry, metadata);
+        journal_put(ar, entry);
+    }
+    free(written.extents);
+    buffer_put(data, block_size);
+    free(kept);
+    free(old_positions);
+    return num_written;
+}
+
+bool update_files_in_archive(const char *archive_name, char **filenames, int num_files, int codec, bool dedup, int jobs, bool verbose, bool very_verbose) {
+    Archive ar;
+    if (!archive_open(&ar, archive_name, true)) return false;
+    if (dedup) dedup_enable(&ar);
+
+    IngestFile *files = ingest_file_list(filenames, num_files, codec);
+    size_t num_updates = 0;
+    bool ok = true;
+    for (int i = 0; i < num_files; i++) {
+        const char *filename = filenames[i];
+        FileEntry *entry = fat_find(&ar.fat, filename);
+
+        if (entry == NULL) {
+            fprintf(stderr, "Archivo '%s' no encontrado en el archivo empacado.\n", filename);
+            ok = false;
+            continue;
+        }
+
+        // Abrir el contenido actualizado antes de soltar los bloques viejos
+        int input_fd = open(filename, O_RDONLY);
+        if (input_fd < 0) {
+            fprintf(stderr, "Error al abrir el archivo de entrada: %s\n", filename);
+            ok = false;
+            continue;
+        }
+
+        // Si ya tiene hashes y el contenido no cambia de formato, solo se reescriben los bloques distintos
+        struct stat st;
+        int file_codec = codec < 0 ? entry->codec : codec; // sin -z se mantiene la compresión que tenia
+        // (los huecos se detectan al ingresar el archivo completo)
+        if (file_codec == CODEC_NONE && entry->codec == CODEC_NONE && entry->num_frames == 0 && !entry->packed && entry->num_hashes > 0 &&
+            fstat(input_fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size >= ar.sb.block_size &&
+            (size_t)st.st_blocks * 512 >= (size_t)st.st_size) {
+            EntryMetadata metadata = metadata_from_stat(&st);
+            size_t num_written = update_blocks(&ar, entry, input_fd, &metadata, very_verbose);
+            close(input_fd);
+            if (num_written == (size_t)-1) {
+                fprintf(stderr, "Error al leer el archivo de entrada: %s\n", filename);
+                ok = false;
+            } else if (verbose) {
+                printf("Archivo '%s' actualizado en el archivo empacado (%zu de %zu bloques escritos).\n", filename, num_written, entry->num_blocks);
+            }
+            continue;
+        }
+
+        // Los bloques anteriores se sueltan al escribir el contenido nuevo: si no se puede leer quedan como estaban
+        if (very_verbose) {
+            for (size_t k = 0; k < entry->num_extents; k++) {
+                printf("Bloques %zu a %zu del archivo '%s' marcados como libres.\n", entry->extents[k].position,
+                       entry->extents[k].position + (entry->extents[k].num_blocks - 1) * ar.sb.block_size, filename);
+            }
+        }
+        files[num_updates].codec = file_codec;
+        files[num_updates].filename = filename;
+        files[num_updates++].fd = input_fd;
+    }
+
+    // Leer el contenido actualizado de los archivos
+    IngestOptions options = {false, "Error al leer el archivo de entrada: %s\n", "Archivo '%s' actualizado en el archivo empacado.\n", verbose, very_verbose};
+    ok &= ingest_files(&ar, files, num_updates, jobs, &options);
+    free(files);
+
+    // Confirmar los cambios en el registro
+    dedup_report(&ar, verbose);
+    archive_close(&ar);
+    return ok;
+}
+
+typedef struct {
+    size_t position;
+    size_t num_blocks;
+    FileEntry *entry;
+    size_t index; // posición de la entrada en el FAT
+} ExtentRef;
+
+int compare_extent_refs(const void *a, const void *b) {
+    size_t x = ((const ExtentRef *)a)->position;
+    size_t y = ((const ExtentRef *)b)->position;
+    return (x > y) - (x < y);
+}
+
+volatile sig_atomic_t defrag_interrupted = 0;
+
+void defrag_interrupt(int signal) {
+    (void)signal;
+    defrag_interrupted = 1; // se termina la copia en curso y se guarda el índice
+}
+
+bool copy_within_archive(Archive *ar, size_t from, size_t to, size_t length) {
+    // el destino siempre es espacio libre, asi que nunca se cruza con el origen
+    int fd = fileno(ar->file);
+    loff_t in_offset = from;
+    loff_t out_offset = to;
+    while (atomic_load(&ar->copy_file_range_ok) && length > 0) {
+        uint64_t start = stats_now();
+        ssize_t copied = copy_file_range(fd, &in_offset, fd, &out_offset, length, 0);
+        if (copied > 0) {
+            stats_io(fd, in_offset - copied, copied, false, 0);
+            stats_io(fd, out_offset - copied, copied, true, start);
+            length -= copied;
+            continue;
+        }
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied == 0 || errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) {
+            atomic_store(&ar->copy_file_range_ok, false);
+            break;
+        }
+        return false;
+    }
+
+    // respaldo: trozos por ar->io, con IO_COPY_DEPTH lecturas adelantadas a la escritura que sigue
+    if (length == 0) return true;
+    size_t chunk = length < IO_READ_SIZE ? length : IO_READ_SIZE;
+    size_t num_chunks = (length + chunk - 1) / chunk;
+    unsigned char *buffers = buffer_get(IO_COPY_DEPTH * chunk);
+    IoBatch batches[IO_COPY_DEPTH] = {{0}};
+    bool ok = true;
+    size_t reads = 0;
+    for (size_t w = 0; ok && w < num_chunks; w++) {
+        for (; reads < num_chunks && reads < w + IO_COPY_DEPTH; reads++) {
+            IoBatch *batch = &batches[reads % IO_COPY_DEPTH];
+            io_wait_batch(&ar->io, batch); // la escritura anterior desde este lugar
+            size_t n = length - reads * chunk < chunk ? length - reads * chunk : chunk;
+            io_batch_read(&ar->io, batch, fd, buffers + (reads % IO_COPY_DEPTH) * chunk, n, in_offset + reads * chunk);
+        }
+        IoBatch *batch = &batches[w % IO_COPY_DEPTH];
+        io_wait_batch(&ar->io, batch);
+        ok = !batch->failed;
+        size_t n = length - w * chunk < chunk ? length - w * chunk : chunk;
+        if (ok) io_batch_write(&ar->io, batch, fd, buffers + (w % IO_COPY_DEPTH) * chunk, n, out_offset + w * chunk);
+    }
+    io_wait(&ar->io, 0); // el que llama registra el movimiento recién con los datos en su lugar
+    for (size_t i = 0; i < IO_COPY_DEPTH; i++) ok = ok && !batches[i].failed;
+    buffer_put(buffers, IO_COPY_DEPTH * chunk);
+    return ok;
+}
 
 typedef struct {
-    unsigned char data[BLOCK_SIZE];
-} Block; 
+    Archive *ar;
+    bool *moved; // por archivo del FAT
+    size_t moved_bytes;
+    bool failed;
+} Defrag;
 
+bool defrag_move(Defrag *defrag, const char *filename, size_t source, size_t target, size_t num_blocks, bool very_verbose) {
+    // el destino sale del asignador, asi que nunca pisa algo que el índice guardado o el registro todavia usan
+    Archive *ar = defrag->ar;
+    if (!copy_within_archive(ar, source, target, num_blocks * ar->sb.block_size)) {
+        fprintf(stderr, "Error al mover el archivo '%s'\n", filename);
+        allocator_free(&ar->alloc, target, num_blocks);
+        defrag->failed = true;
+        return false;
+    }
+    defrag->moved_bytes += num_blocks * ar->sb.block_size;
 
-struct Flags {
-    bool create;
-    bool extract;
-    bool list;
-    bool delete;
-    bool update;
-    bool verbose;
-    bool veryVerbose;
-    bool file;
-    bool append;
-    bool pack;
-    char *outputFile;
-    char **inputFiles;
-    int numInputFiles;
-};
+    if (very_verbose) {
+        printf("%zu bloques del archivo '%s' movidos de la posición %zu a la posición %zu\n", num_blocks, filename, source, target);
+    }
+    return true;
+}
+
+void defrag_record(Defrag *defrag, size_t source, size_t target, size_t num_blocks) {
+    // despues de actualizar el FAT, por si el registro se llena y se guarda el índice completo. Si se corta
+    // antes de confirmar el registro la copia se pierde, pero el origen sigue intacto hasta entonces
+    JournalMove move = {source, target, num_blocks};
+    blocks_move(defrag->ar, source, target, num_blocks);
+    archive_release(defrag->ar, source, num_blocks);
+    journal_append(defrag->ar, JOURNAL_MOVE, &move, sizeof(JournalMove));
+}
 
-size_t find_free_block(FAT *fat) {
-    for (size_t i = 0; i < fat->num_free_blocks; i++) {
-        // NOTA: num_free_blocks solo implica el rango de bloques libres, no necesariamente que todos los bloques estén libres
-        if (fat->free_blocks[i] != 0) {
-            size_t free_block = fat->free_blocks[i]; // obtener el bloque libre
-            fat->free_blocks[i] = 0; // marcar el bloque como ocupado
-            return free_block;
+size_t defrag_units(Archive *ar, ExtentRef **refs) {
+    // cada extent es una unidad; los archivos empaquetados en el mismo bloque quedan seguidos y se mueven juntos.
+    // Los bloques deduplicados son unidades de un bloque, asi todos los archivos que los usan se mueven juntos
+    size_t block_size = ar->sb.block_size;
+    size_t num_refs = 0;
+    for (size_t i = 0; i < ar->fat.num_files; i++) {
+        FileEntry *entry = &ar->fat.files[i];
+        for (size_t j = 0; j < entry->num_extents; j++) {
+            num_refs += extent_shared(ar, entry->extents[j].position, entry->extents[j].num_blocks) ? entry->extents[j].num_blocks : 1;
+        }
+    }
+    *refs = xrealloc(*refs, (num_refs + 1) * sizeof(ExtentRef));
+    num_refs = 0;
+    for (size_t i = 0; i < ar->fat.num_files; i++) {
+        FileEntry *entry = &ar->fat.files[i];
+        if (entry->deleted) continue;
+        for (size_t j = 0; j < entry->num_extents; j++) {
+            size_t position = entry->extents[j].position;
+            size_t num_blocks = entry->extents[j].num_blocks;
+            if (!extent_shared(ar, position, num_blocks)) {
+                (*refs)[num_refs++] = (ExtentRef){position, num_blocks, entry, i};
+                continue;
+            }
+            // corridas de bloques propios entre los compartidos
+            for (size_t k = 0; k < num_blocks; ) {
+                size_t run = 1;
+                if (!extent_shared(ar, position + k * block_size, 1)) {
+                    while (k + run < num_blocks && !extent_shared(ar, position + (k + run) * block_size, 1)) run++;
+                }
+                (*refs)[num_refs++] = (ExtentRef){position + k * block_size, run, entry, i};
+                k += run;
+            }
         }
     }
-    return (size_t)-1; // si no se ha encontrado ningun bloque libre
+    qsort(*refs, num_refs, sizeof(ExtentRef), compare_extent_refs);
+    return num_refs;
 }
 
-void expand_archive(FILE *archive, FAT *fat) {
-    fseek(archive, 0, SEEK_END); // mover el puntero al final del archivo
-    size_t current_size = ftell(archive); // obtener la posición actual del puntero (tamaño del archivo)
-    size_t expanded_size = current_size + BLOCK_SIZE; // tamaño del archivo expandido (+256KB)
-    ftruncate(fileno(archive), expanded_size); // expandir el archivo
-    fat->free_blocks[fat->num_free_blocks++] = current_size; 
-    // meter el bloque libre a la lista secuencial de bloques libres 
+void defrag_remap(Defrag *defrag, ExtentRef *refs, size_t start, size_t end, size_t source, size_t target, size_t num_blocks) {
+    for (size_t i = start; i < end; i++) {
+        entry_remap(refs[i].entry, source, target, num_blocks, defrag->ar->sb.block_size);
+        defrag->moved[refs[i].index] = true;
+    }
+    defrag_record(defrag, source, target, num_blocks);
 }
 
-void list_archive_contents(const char *archive_name, bool verbose) {
-    FILE *archive = fopen(archive_name, "rb");
-    if (archive == NULL) {
-        fprintf(stderr, "Error al abrir el archivo empacado.\n");
-        return;
+bool defrag_joinable(Archive *ar, FileEntry *entry) {
+    // partido en varios extents y sin bloques compartidos: unirlo duplicaría los que comparte
+    if (entry->packed || entry->num_extents < 2) return false;
+    for (size_t j = 0; j < entry->num_extents; j++) {
+        if (extent_shared(ar, entry->extents[j].position, entry->extents[j].num_blocks)) return false;
     }
+    return true;
+}
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, archive);
-
-    printf("Contenido del archivo empacado:\n");
-    printf("-------------------------------\n");
+void defrag_join(Defrag *defrag, bool verbose, bool very_verbose) {
+    // los archivos partidos en varios extents se copian a una corrida contigua, de preferencia en un hueco
+    Archive *ar = defrag->ar;
+    size_t block_size = ar->sb.block_size;
+    for (size_t i = 0; i < ar->fat.num_files && !defrag_interrupted && !defrag->failed; i++) {
+        FileEntry *entry = &ar->fat.files[i];
+        if (entry->deleted || !defrag_joinable(ar, entry)) continue;
 
-    for (size_t i = 0; i < fat.num_files; i++) {
-        FileEntry entry = fat.files[i];
-        printf("%s\t%zu bytes\n", entry.filename, entry.file_size);
+        size_t num_blocks = entry->num_blocks;
+        size_t target = allocator_alloc(&ar->alloc, ar->file, num_blocks);
+        size_t end = target + num_blocks * block_size;
+        size_t num_extents = entry->num_extents;
+        Extent *extents = xrealloc(NULL, num_extents * sizeof(Extent));
+        memcpy(extents, entry->extents, num_extents * sizeof(Extent));
 
-        if (verbose) {
-            printf("  Bloques: ");
-            for (size_t j = 0; j < entry.num_blocks; j++) {
-                printf("%zu ", entry.block_positions[j]);
+        size_t offset = target;
+        for (size_t j = 0; j < num_extents && !defrag->failed; j++) {
+            if (defrag_move(defrag, entry->filename, extents[j].position, offset, extents[j].num_blocks, very_verbose)) {
+                entry_remap(entry, extents[j].position, offset, extents[j].num_blocks, block_size);
+                defrag_record(defrag, extents[j].position, offset, extents[j].num_blocks);
             }
-            printf("\n");
+            offset += extents[j].num_blocks * block_size;
         }
-    }
+        if (offset < end) allocator_free(&ar->alloc, offset, (end - offset) / block_size); // lo que no se alcanzó a usar
+        free(extents);
+        defrag->moved[i] = true;
 
-    fclose(archive);
+        if (verbose && !defrag->failed) {
+            printf("Archivo '%s' desfragmentado.\n", entry->filename);
+        }
+    }
 }
 
+void defrag_fill(Defrag *defrag, ExtentRef **units, bool very_verbose) {
+    // desde el final del archivo, cada archivo contiguo que quepa entero en un hueco anterior baja a ese hueco
+    Archive *ar = defrag->ar;
+    size_t num_refs = defrag_units(ar, units);
+    ExtentRef *refs = *units;
+    for (size_t end = num_refs; end > 0 && !defrag_interrupted && !defrag->failed; ) {
+        size_t start = end - 1;
+        while (start > 0 && refs[start - 1].position == refs[start].position) start--;
+        size_t position = refs[start].position;
+        size_t num_blocks = refs[start].num_blocks;
+        if (defrag_joinable(ar, refs[start].entry)) { // los partidos se unen despues, moverlos ahora es trabajo perdido
+            end = start;
+            continue;
+        }
 
-void write_block(FILE *archive, Block *block, size_t position) {
-    fseek(archive, position, SEEK_SET); // conseguir la posicion marcada por el indice del bloque libre
-    fwrite(block, sizeof(Block), 1, archive); // escribir los 256KB del bloque en el archivo
+        size_t target = allocator_take(&ar->alloc, num_blocks);
+        if (target != (size_t)-1 && target > position) {
+            allocator_free(&ar->alloc, target, num_blocks); // el primer hueco donde cabe está despues
+        } else if (target != (size_t)-1 && defrag_move(defrag, refs[start].entry->filename, position, target, num_blocks, very_verbose)) {
+            defrag_remap(defrag, refs, start, end, position, target, num_blocks);
+        }
+        end = start;
+    }
 }
 
-void update_fat(FAT *fat, const char *filename, size_t file_size, size_t block_position, size_t bytes_read) {
-    for (size_t i = 0; i < fat->num_files; i++) { // por cada archivo en el FAT
-        if (strcmp(fat->files[i].filename, filename) == 0) { // si el archivo ya esta en el FAT
-            fat->files[i].block_positions[fat->files[i].num_blocks++] = block_position;  // añadir la nueva posicion del bloque al archivo
-            fat->files[i].file_size += bytes_read; // incrementar el tamaño del archivo
-            return; // salir
+void defrag_slide(Defrag *defrag, ExtentRef **units, bool very_verbose) {
+    // de adelante hacia atras, cada unidad con un hueco justo antes se corre hacia ese hueco. Si la unidad es mas
+    // grande que el hueco se mueve por partes del tamaño del hueco, asi ninguna copia pisa su propio origen
+    Archive *ar = defrag->ar;
+    size_t block_size = ar->sb.block_size;
+    size_t num_refs = defrag_units(ar, units);
+    ExtentRef *refs = *units;
+    for (size_t start = 0; start < num_refs && !defrag_interrupted && !defrag->failed; ) {
+        size_t end = start + 1;
+        while (end < num_refs && refs[end].position == refs[start].position) end++;
+        size_t position = refs[start].position;
+        size_t remaining = refs[start].num_blocks;
+
+        while (remaining > 0 && !defrag->failed) {
+            journal_commit(ar); // el hueco de antes puede incluir el origen de un movimiento sin confirmar
+            size_t hole = allocator_hole_before(&ar->alloc, position);
+            if (hole == (size_t)-1) break;
+
+            size_t gap = ar->alloc.extents[hole].num_blocks;
+            size_t num_blocks = remaining < gap ? remaining : gap;
+            size_t target = allocator_take_from(&ar->alloc, hole, num_blocks);
+            if (!defrag_move(defrag, refs[start].entry->filename, position, target, num_blocks, very_verbose)) break;
+            defrag_remap(defrag, refs, start, end, position, target, num_blocks);
+            position += num_blocks * block_size;
+            remaining -= num_blocks;
         }
+        start = end;
     }
-
-    // si no hay una entrada para el archivo en el FAT
-    FileEntry new_entry;
-    strncpy(new_entry.filename, filename, MAX_FILENAME_LENGTH); // copiar el nombre del archivo a la nueva entrada
-    new_entry.file_size = file_size + bytes_read; // tamaño del archivo
-    new_entry.block_positions[0] = block_position; // posición del bloque
-    new_entry.num_blocks = 1; // número de bloques
-    fat->files[fat->num_files++] = new_entry; // añadir la nueva entrada al FAT
 }
 
-void write_fat(FILE *archive, FAT *fat) {
-    fseek(archive, 0, SEEK_SET); // mover el puntero al inicio del archivo
-    fwrite(fat, sizeof(FAT), 1, archive); // escribir la FAT en el archivo en la posición 0
-    // NOTA: implica que los indices de los bloques libres y bloques ocupados son despues de la FAT
-}
+void defragment_archive(const char *archive_name, bool verbose, bool very_verbose) {
+    Archive ar;
+    if (!archive_open(&ar, archive_name, true)) return;
 
+    struct sigaction action = {0}, old_int, old_term;
+    action.sa_handler = defrag_interrupt;
+    sigaction(SIGINT, &action, &old_int);
+    sigaction(SIGTERM, &action, &old_term);
+    defrag_interrupted = 0;
 
-void create_archive(struct Flags flags) {
-    if (flags.verbose) printf("Creando archivo %s\n", flags.outputFile);
-    FILE *archive = fopen(flags.outputFile, "wb"); // abrir archivo como binario para escritura
+    // el índice y el registro se mudan al final del archivo, fuera de la zona que se compacta. Lo que una
+    // desfragmentación anterior alcanzó a mover ya se aplicó al abrir y queda incluido en este índice
+    size_t block_size = ar.sb.block_size;
+    ar.defragmenting = true;
+    write_fat(&ar);
+    io_init(&ar.io, 2 * IO_COPY_DEPTH); // solo se usa si copy_file_range no sirve
+    io_set_direct(&ar.io, fileno(ar.file), ar.direct_fd);
 
-    if (archive == NULL) {
-        fprintf(stderr, "Error al abrir el archivo %s\n", flags.outputFile);
-        exit(1);
-    }
+    Defrag defrag = {.ar = &ar};
+    defrag.moved = xrealloc(NULL, (ar.fat.num_files + 1) * sizeof(bool));
+    memset(defrag.moved, 0, (ar.fat.num_files + 1) * sizeof(bool));
+    ExtentRef *refs = NULL;
 
-    FAT fat; 
-    memset(&fat, 0, sizeof(FAT)); // inicializa FAT con 0s 
+    // plan: bajar los archivos del final a los huecos donde caben enteros, correr lo que queda detras de cada
+    // hueco, unir los archivos partidos (si no caben en el espacio que quedó libre van al final) y volver a
+    // compactar y llenar para traer de vuelta lo que quedó despues del registro
+    defrag_fill(&defrag, &refs, very_verbose);
+    defrag_slide(&defrag, &refs, very_verbose);
+    journal_commit(&ar);
+    defrag_join(&defrag, verbose, very_verbose);
+    journal_commit(&ar);
+    defrag_slide(&defrag, &refs, very_verbose);
+    defrag_fill(&defrag, &refs, very_verbose);
 
-    fat.free_blocks[0] = sizeof(FAT); // el primer bloque libre es despues de la FAT
-    fat.num_free_blocks = 1; // solo hay un bloque libre
+    // lo que ningun movimiento tocó
+    size_t skipped_bytes = 0;
+    size_t num_refs = defrag_units(&ar, &refs);
+    for (size_t i = 0; i < num_refs; i++) {
+        if (i > 0 && refs[i].position == refs[i - 1].position) continue;
+        if (!defrag.moved[refs[i].index]) skipped_bytes += refs[i].num_blocks * block_size;
+    }
+    free(refs);
+    free(defrag.moved);
 
-    fwrite(&fat, sizeof(FAT), 1, archive); // escribir la FAT en el archivo (posición 0
+    // los bloques compartidos cambiaron de lugar
+    free(ar.slabs);
+    ar.slabs = NULL;
+    ar.num_slabs = ar.slabs_capacity = 0;
+    slabs_build(&ar);
 
-    if (flags.file && flags.numInputFiles > 0) {
-        // si se me pasan archivos
-        for (int i = 0; i < flags.numInputFiles; i++) {
-            FILE *input_file = fopen(flags.inputFiles[i], "rb"); // abrir archivo como binario para lectura
-            if (input_file == NULL) {
-                fprintf(stderr, "Error al abrir el archivo %s\n", flags.inputFiles[i]);
-                exit(1);
-            }
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    if (defrag_interrupted) {
+        fprintf(stderr, "Desfragmentación interrumpida, vuelva a ejecutar -p para continuar.\n");
+    }
+    if (verbose || defrag_interrupted) {
+        printf("Desfragmentación: %zu bytes movidos, %zu bytes se quedaron en su lugar.\n", defrag.moved_bytes, skipped_bytes);
+    }
 
-            if (flags.verbose) printf("Agregando archivo %s\n", flags.inputFiles[i]);
-            size_t file_size = 0; 
-            size_t block_count = 0; 
-            Block block; 
-            size_t bytes_read; 
+    // el índice final ya incluye todo lo movido y vuelve al primer hueco donde quepa; si no cupo antes del
+    // anterior, cabe en el lugar que este dejó, asi el final del archivo se puede recortar
+    ar.defragmenting = false;
+    size_t previous_index = ar.sb.index_offset;
+    write_fat(&ar);
+    if (ar.sb.index_offset > previous_index) write_fat(&ar);
+    archive_close(&ar);
+}
 
-            while ((bytes_read = fread(&block, 1, sizeof(Block), input_file)) > 0) {
-                // mientras que pueda leer un bloque del archivo
-                size_t block_position = find_free_block(&fat); // indice del bloque libre
-                if (block_position == (size_t)-1) {
-                    // si no hay bloques libres 
-                    if (flags.veryVerbose) {
-                        printf("No hay bloques libres, expandiendo el archivo\n");
-                    }
-                    expand_archive(archive, &fat); // expandir el archivo
-                    block_position = find_free_block(&fat); 
-                    if (flags.veryVerbose) {
-                        printf("Nuevo bloque libre en la posición %zu\n", block_position);
-                    }
-                }
+bool append_files_to_archive(const char *archive_name, char **filenames, int num_files, int codec, bool dedup, int jobs, bool verbose, bool very_verbose) {
+    Archive ar;
+    if (!archive_open(&ar, archive_name, true)) return false;
+    bool ok;
+    if (dedup) dedup_enable(&ar);
+    if (codec < 0) codec = CODEC_NONE;
 
-                if (bytes_read < sizeof(Block)) {
-                    // si no se lee un bloque completo
-                    memset((char*)&block + bytes_read, 0, sizeof(Block) - bytes_read); // rellenar con 0s
-                }
+    if (num_files == 0) {
+        // Leer desde la entrada estándar (stdin)
+        IngestOptions options = {false, "Error al leer la entrada estándar: %s\n", "Contenido de stdin agregado al archivo empacado como '%s'.\n", verbose, very_verbose};
+        IngestFile input = {.filename = "stdin", .fd = STDIN_FILENO, .codec = codec};
+        ok = ingest_files(&ar, &input, 1, jobs, &options);
+    } else {
+        // Agregar archivos especificados
+        IngestOptions options = {false, "Error al abrir el archivo de entrada: %s\n", "Archivo '%s' agregado al archivo empacado.\n", verbose, very_verbose};
+        size_t count;
+        bool walk_failed;
+        IngestFile *files = ingest_walk(filenames, num_files, codec, jobs, &count, &walk_failed);
+        ok = ingest_files(&ar, files, count, jobs, &options) && !walk_failed;
+        ingest_free_walk(files, count);
+    }
 
-                write_block(archive, &block, block_position); // escribir el bloque en el archivo
-                update_fat(&fat, flags.inputFiles[i], file_size, block_position, bytes_read); // actualizar la FAT para que refleje el nuevo bloque
+    // Confirmar los cambios en el registro
+    dedup_report(&ar, verbose);
+    archive_close(&ar);
+    return ok;
+}
 
-                file_size += bytes_read;
-                block_count++;
+typedef enum {
+    PIPE_EXTRACT,
+    PIPE_TO_STDOUT,
+    PIPE_LIST,
+} PipeMode;
 
-                if (flags.veryVerbose) {
-                    printf("Escribiendo bloque %zu para archivo %s\n", block_position, flags.inputFiles[i]);
-                }
-            }
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} PipeHeader;
 
-            if (flags.verbose) printf("Tamaño del archivo %s: %zu bytes\n", flags.inputFiles[i], file_size);
+typedef struct {
+    uint32_t type; // PIPE_MEMBER o PIPE_INDEX
+    uint32_t name_length; // el nombre va a continuación, sin '\0'
+    uint64_t size; // PIPE_SIZE_UNKNOWN si la entrada no es un archivo regular
+    uint32_t codec;
+    uint32_t reserved;
+} PipeMember;
 
-            fclose(input_file);
-        }
-    } else {
-        if (flags.verbose) {
-            printf("Leyendo datos desde la entrada estándar (stdin)\n");
-        }
+typedef struct {
+    uint32_t frame; // bytes almacenados y FRAME_RAW, igual que en el índice; 0 termina el archivo
+    uint32_t length; // bytes originales
+    uint64_t hash; // del contenido original
+} PipeChunk;
 
-        size_t file_size = 0;
-        size_t block_count = 0;
-        Block block;
-        size_t bytes_read;
-        while ((bytes_read = fread(&block, 1, sizeof(Block), stdin)) > 0) {
-            size_t block_position = find_free_block(&fat);
-            if (block_position == (size_t)-1) {
-                expand_archive(archive, &fat);
-                block_position = find_free_block(&fat);
-            }
+typedef struct {
+    uint64_t offset; // donde empieza la cabecera del archivo
+    uint64_t size;
+    uint32_t name_length;
+    uint32_t reserved;
+} PipeIndexEntry;
 
-            if (bytes_read < sizeof(Block)) {
-                memset((char*)&block + bytes_read, 0, sizeof(Block) - bytes_read);
-            }
+typedef struct {
+    uint64_t index_offset;
+    uint64_t num_members;
+    uint32_t magic; // PIPE_END_MAGIC, lo ultimo del flujo
+    uint32_t reserved;
+} PipeFooter;
 
-            write_block(archive, &block, block_position);
-            update_fat(&fat, "stdin", file_size, block_position, bytes_read);
+typedef struct {
+    const char *name;
+    uint64_t offset;
+    uint64_t size;
+} PipeIndexRecord;
 
-            bytes_read += sizeof(Block);
-            block_count++;
+int pipe_open(const char *archive_name, bool output) {
+    if (strcmp(archive_name, "-") == 0) return output ? STDOUT_FILENO : STDIN_FILENO;
+    return output ? open(archive_name, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(archive_name, O_RDONLY);
+}
 
-            if (flags.veryVerbose) {
-                printf("Bloque %zu leído desde stdin y escrito en la posición %zu\n", block_count, block_position);
-            }
+bool pipe_create_archive(const char *archive_name, char **filenames, int num_files, int codec, bool verbose) {
+    // todo se escribe una sola vez y en orden: cabecera y datos de cada archivo en trozos con su hash, y al
+    // final un índice con la posición de cada cabecera para quien sí pueda buscar.
+    // El flujo no guarda directorios, enlaces ni metadatos: las entradas se revisan antes de escribir nada
+    bool inputs_ok = true;
+    for (int i = 0; i < num_files; i++) {
+        struct stat st;
+        if (stat(filenames[i], &st) != 0 || access(filenames[i], R_OK) != 0) {
+            fprintf(stderr, "Error al abrir el archivo %s\n", filenames[i]);
+            inputs_ok = false;
+        } else if (!S_ISREG(st.st_mode)) {
+            fprintf(stderr, "Error: %s no es un archivo regular, el modo flujo solo guarda archivos regulares\n", filenames[i]);
+            inputs_ok = false;
         }
     }
+    if (!inputs_ok) return false;
 
-    write_fat(archive, &fat);
-    fclose(archive);
-}
-
-void extract_archive(const char *archive_name, bool verbose, bool very_verbose) {
-    FILE *archive = fopen(archive_name, "rb");
-    if (archive == NULL) {
-        fprintf(stderr, "Error al abrir el archivo empacado.\n");
-        return;
+    int fd = pipe_open(archive_name, true);
+    if (fd < 0) {
+        fprintf(stderr, "Error al abrir el archivo %s\n", archive_name);
+        return false;
     }
+    FILE *log = fd == STDOUT_FILENO ? stderr : stdout; // los mensajes no se mezclan con los datos
+    if (codec < 0) codec = CODEC_NONE;
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, archive);
+    unsigned char *data = buffer_get(PIPE_CHUNK_SIZE);
+    unsigned char *packed = buffer_get(LZ_BOUND(PIPE_CHUNK_SIZE));
+    PipeIndexRecord *index = xrealloc(NULL, (num_files + 1) * sizeof(PipeIndexRecord));
+    size_t num_members = 0;
+    uint64_t offset = 0;
+    bool ok = true;
+    bool skipped = false; // una entrada que desapareció o dejó de poder leerse despues de revisarla
 
-    for (size_t i = 0; i < fat.num_files; i++) {
-        FileEntry entry = fat.files[i];
-        FILE *output_file = fopen(entry.filename, "wb");
-        if (output_file == NULL) {
-            fprintf(stderr, "Error al crear el archivo de salida: %s\n", entry.filename);
+    PipeHeader header = {PIPE_MAGIC, PIPE_VERSION};
+    ok = write_all(fd, (unsigned char *)&header, sizeof(header));
+    offset += sizeof(header);
+
+    for (int i = 0; ok && i < (num_files > 0 ? num_files : 1); i++) {
+        const char *name = num_files > 0 ? filenames[i] : "stdin";
+        int input_fd = num_files > 0 ? open(name, O_RDONLY) : STDIN_FILENO;
+        if (input_fd < 0) {
+            fprintf(stderr, "Error al abrir el archivo %s\n", name);
+            skipped = true;
             continue;
         }
+        struct stat st;
+        PipeMember member = {PIPE_MEMBER, strlen(name), PIPE_SIZE_UNKNOWN, codec, 0};
+        if (fstat(input_fd, &st) == 0 && S_ISREG(st.st_mode)) member.size = st.st_size;
+        posix_fadvise(input_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-        if (verbose) {
-            printf("Extrayendo archivo: %s\n", entry.filename);
+        index[num_members] = (PipeIndexRecord){name, offset, 0};
+        ok = write_all(fd, (unsigned char *)&member, sizeof(member)) && write_all(fd, (const unsigned char *)name, member.name_length);
+        offset += sizeof(member) + member.name_length;
+
+        ssize_t length;
+        while (ok && (length = read_block(input_fd, data, PIPE_CHUNK_SIZE)) > 0) {
+            PipeChunk chunk = {length | FRAME_RAW, length, hash_block(data, length)};
+            const unsigned char *stored = data;
+            if (codec != CODEC_NONE) {
+                size_t packed_length = codecs[codec].compress(data, length, packed, LZ_BOUND(PIPE_CHUNK_SIZE));
+                if (packed_length > 0 && packed_length < (size_t)length) {
+                    chunk.frame = packed_length;
+                    stored = packed;
+                }
+            }
+            size_t stored_length = chunk.frame & FRAME_SIZE_MASK;
+            ok = write_all(fd, (unsigned char *)&chunk, sizeof(chunk)) && write_all(fd, stored, stored_length);
+            offset += sizeof(chunk) + stored_length;
+            index[num_members].size += length;
+        }
+        if (length < 0) {
+            fprintf(stderr, "Error al leer el archivo %s\n", name);
+            ok = false;
         }
+        PipeChunk end = {0, 0, 0};
+        ok = ok && write_all(fd, (unsigned char *)&end, sizeof(end));
+        offset += sizeof(end);
+        if (input_fd != STDIN_FILENO) close(input_fd);
 
-        size_t file_size = 0;
-        for (size_t j = 0; j < entry.num_blocks; j++) {
-            Block block;
-            fseek(archive, entry.block_positions[j], SEEK_SET);
-            fread(&block, sizeof(Block), 1, archive);
+        if (ok && verbose) fprintf(log, "Archivo '%s' agregado al flujo (%zu bytes).\n", name, (size_t)index[num_members].size);
+        num_members++;
+    }
 
-            size_t bytes_to_write = (file_size + sizeof(Block) > entry.file_size) ? entry.file_size - file_size : sizeof(Block);
-            fwrite(&block, 1, bytes_to_write, output_file);
+    // índice final: solo guarda la posición y el tamaño de cada archivo, los nombres son los de la línea de comandos
+    uint64_t index_offset = offset;
+    PipeMember index_header = {PIPE_INDEX, 0, num_members, 0, 0}; // en el índice size es la cantidad de archivos
+    ok = ok && write_all(fd, (unsigned char *)&index_header, sizeof(index_header));
+    for (size_t m = 0; ok && m < num_members; m++) {
+        PipeIndexEntry entry = {index[m].offset, index[m].size, strlen(index[m].name), 0};
+        ok = write_all(fd, (unsigned char *)&entry, sizeof(entry)) && write_all(fd, (const unsigned char *)index[m].name, entry.name_length);
+    }
+    PipeFooter footer = {index_offset, num_members, PIPE_END_MAGIC, 0};
+    ok = ok && write_all(fd, (unsigned char *)&footer, sizeof(footer));
+    if (!ok) fprintf(stderr, "Error al escribir el flujo %s\n", archive_name);
 
-            file_size += bytes_to_write;
+    if (fd != STDOUT_FILENO) close(fd);
+    free(index);
+    buffer_put(packed, LZ_BOUND(PIPE_CHUNK_SIZE));
+    buffer_put(data, PIPE_CHUNK_SIZE);
+    return ok && !skipped;
+}
 
-            if (very_verbose) {
-                printf("Bloque %zu del archivo %s extraído de la posición %zu\n", j + 1, entry.filename, entry.block_positions[j]);
-            }
-        }
+bool pipe_read_exact(int fd, void *data, size_t length) {
+    return read_block(fd, data, length) == (ssize_t)length;
+}
 
-        fclose(output_file);
+bool pipe_skip(int fd, size_t length) {
+    unsigned char buffer[4096];
+    while (length > 0) {
+        size_t n = length < sizeof(buffer) ? length : sizeof(buffer);
+        if (!pipe_read_exact(fd, buffer, n)) return false;
+        length -= n;
     }
+    return true;
+}
 
-    fclose(archive);
+bool name_selected(const char *name, char **patterns, int num_patterns, bool *matched) {
+    // como select_members, pero sin índice: cada archivo del flujo se compara al pasar y se marcan los
+    // patrones que lo eligen, los que terminan sin marcar se reportan al final
+    bool selected = num_patterns == 0;
+    for (int p = 0; p < num_patterns; p++) {
+        if (strcmp(patterns[p], name) == 0 || fnmatch(patterns[p], name, 0) == 0) {
+            matched[p] = true;
+            selected = true;
+        }
+    }
+    return selected;
 }
 
-void delete_files_from_archive(const char *archive_name, char **filenames, int num_files, bool verbose, bool very_verbose) {
-    FILE *archive = fopen(archive_name, "rb+");
-    if (archive == NULL) {
+bool pipe_read_archive(const char *archive_name, char **filenames, int num_files, PipeMode mode, bool verbose) {
+    // una sola pasada hacia adelante sin buscar, con memoria fija: un trozo y su versión comprimida
+    int fd = pipe_open(archive_name, false);
+    if (fd < 0) {
         fprintf(stderr, "Error al abrir el archivo empacado.\n");
-        return;
+        return false;
+    }
+    FILE *log = mode == PIPE_TO_STDOUT ? stderr : stdout;
+    PipeHeader header;
+    if (!pipe_read_exact(fd, &header, sizeof(header)) || header.magic != PIPE_MAGIC || header.version != PIPE_VERSION) {
+        fprintf(stderr, "Error: %s no es un flujo de star.\n", archive_name);
+        if (fd != STDIN_FILENO) close(fd);
+        return false;
     }
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, archive); // leer la FAT del archivo
-
-    for (int i = 0; i < num_files; i++) {
-        const char *filename = filenames[i]; // conseguir el nombre del archivo a borrar
-        bool file_found = false;
-
-        for (size_t j = 0; j < fat.num_files; j++) {
-            if (strcmp(fat.files[j].filename, filename) == 0) { // encontre el archivo
-                file_found = true;
-
-                // Marcar los bloques como libres
-                for (size_t k = 0; k < fat.files[j].num_blocks; k++) {
-                    fat.free_blocks[fat.num_free_blocks++] = fat.files[j].block_positions[k];
-                    if (very_verbose) {
-                        printf("Bloque %zu del archivo '%s' marcado como libre.\n", fat.files[j].block_positions[k], filename);
-                    }
-                }
+    unsigned char *data = buffer_get(PIPE_CHUNK_SIZE);
+    unsigned char *packed = buffer_get(PIPE_CHUNK_SIZE);
+    char *name = NULL;
+    size_t name_capacity = 0;
+    size_t num_members = 0;
+    uint64_t total_size = 0;
+    bool ok = true;
+    bool damaged = false;
+    bool missing = false;
+    bool *matched = calloc(num_files + 1, sizeof(bool));
+    PipeMember member;
 
-                // Eliminar la entrada del archivo del FAT
-                for (size_t k = j; k < fat.num_files - 1; k++) {
-                    fat.files[k] = fat.files[k + 1];
-                }
-                fat.num_files--;
+    while ((ok = pipe_read_exact(fd, &member, sizeof(member))) && member.type == PIPE_MEMBER) {
+        if (member.name_length + 1 > name_capacity) {
+            name_capacity = member.name_length + 1;
+            name = xrealloc(name, name_capacity);
+        }
+        if (!pipe_read_exact(fd, name, member.name_length) || member.codec >= NUM_CODECS) {
+            ok = false;
+            break;
+        }
+        name[member.name_length] = '\0';
+        num_members++;
 
-                if (verbose) {
-                    printf("Archivo '%s' eliminado del archivo empacado.\n", filename);
-                }
+        bool selected = mode != PIPE_LIST && name_selected(name, filenames, num_files, matched);
+        int output_fd = -1;
+        bool member_ok = true;
+        if (selected && mode == PIPE_EXTRACT) {
+            // con las mismas reglas que extract_archive: debajo del directorio actual y sin seguir enlaces
+            const char *path = extract_path(name);
+            if (path == NULL) {
+                fprintf(stderr, "Se omite '%s': la ruta sale del directorio actual\n", name);
+                member_ok = false;
+            } else if ((output_fd = extract_open(path)) < 0) {
+                fprintf(stderr, "Error al crear el archivo de salida: %s\n", name);
+                member_ok = false;
+            }
+        } else if (selected) {
+            output_fd = STDOUT_FILENO;
+        }
+        if (selected && verbose) fprintf(log, "Extrayendo archivo: %s\n", name);
 
+        uint64_t size = 0;
+        PipeChunk chunk;
+        while ((ok = pipe_read_exact(fd, &chunk, sizeof(chunk))) && chunk.frame != 0) {
+            size_t stored = chunk.frame & FRAME_SIZE_MASK;
+            if (chunk.length > PIPE_CHUNK_SIZE || stored > PIPE_CHUNK_SIZE || ((chunk.frame & FRAME_RAW) && stored != chunk.length)) {
+                ok = false;
                 break;
             }
+            size += chunk.length;
+            if (output_fd < 0) {
+                // no se extrae: se lee y se descarta, la entrada no permite saltar
+                ok = pipe_skip(fd, stored);
+                if (!ok) break;
+                continue;
+            }
+            ok = pipe_read_exact(fd, (chunk.frame & FRAME_RAW) ? data : packed, stored);
+            if (!ok) break;
+            bool chunk_ok = (chunk.frame & FRAME_RAW) || codecs[member.codec].decompress(packed, stored, data, chunk.length);
+            if (!chunk_ok || hash_block(data, chunk.length) != chunk.hash) {
+                if (member_ok) fprintf(stderr, "Archivo '%s' dañado en el byte %zu\n", name, (size_t)(size - chunk.length));
+                member_ok = false;
+            }
+            if (!write_all(output_fd, data, chunk.length)) {
+                fprintf(stderr, "Error al extraer el archivo %s\n", name);
+                member_ok = false;
+                if (output_fd == STDOUT_FILENO) {
+                    ok = false;
+                    break;
+                }
+            }
         }
+        if (output_fd >= 0 && output_fd != STDOUT_FILENO) close(output_fd);
+        if (!ok) break;
+        damaged |= !member_ok;
+        total_size += size;
+        if (mode == PIPE_LIST) printf(verbose ? "%s\t%zu bytes (%s)\n" : "%s\t%zu bytes\n", name, (size_t)size, codecs[member.codec].name);
+    }
 
-        if (!file_found) {
-            fprintf(stderr, "Archivo '%s' no encontrado en el archivo empacado.\n", filename);
+    // el índice final se comprueba contra lo que se leyó, sin guardarlo
+    if (ok && member.type == PIPE_INDEX) {
+        uint64_t indexed_size = 0;
+        for (uint64_t m = 0; ok && m < member.size; m++) {
+            PipeIndexEntry entry;
+            ok = pipe_read_exact(fd, &entry, sizeof(entry)) && pipe_skip(fd, entry.name_length);
+            indexed_size += entry.size;
         }
+        PipeFooter footer;
+        ok = ok && pipe_read_exact(fd, &footer, sizeof(footer)) && footer.magic == PIPE_END_MAGIC;
+        ok = ok && member.size == num_members && footer.num_members == num_members && indexed_size == total_size;
+    } else {
+        ok = false;
     }
-
-    // Escribir la estructura FAT actualizada en el archivo
-    fseek(archive, 0, SEEK_SET);
-    fwrite(&fat, sizeof(FAT), 1, archive);
-
-    fclose(archive);
-}
-
-void update_files_in_archive(const char *archive_name, char **filenames, int num_files, bool verbose, bool very_verbose) {
-    FILE *archive = fopen(archive_name, "rb+");
-    if (archive == NULL) {
-        fprintf(stderr, "Error al abrir el archivo empacado.\n");
-        return;
+    if (!ok) fprintf(stderr, "Error: el flujo %s está incompleto o dañado.\n", archive_name);
+    for (int p = 0; ok && mode != PIPE_LIST && p < num_files; p++) {
+        if (!matched[p]) {
+            fprintf(stderr, "Archivo '%s' no encontrado en el archivo empacado.\n", filenames[p]);
+            missing = true;
+        }
     }
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, archive);
+    if (fd != STDIN_FILENO) close(fd);
+    free(matched);
+    free(name);
+    buffer_put(packed, PIPE_CHUNK_SIZE);
+    buffer_put(data, PIPE_CHUNK_SIZE);
+    return ok && !damaged && !missing;
+}
 
+bool pipe_extract_archive(const char *archive_name, char **filenames, int num_files, bool to_stdout, bool verbose) {
+    return pipe_read_archive(archive_name, filenames, num_files, to_stdout ? PIPE_TO_STDOUT : PIPE_EXTRACT, verbose);
+}
 
-    for (int i = 0; i < num_files; i++) {
-        const char *filename = filenames[i];
-        bool file_found = false;
+bool pipe_list_archive(const char *archive_name, bool verbose) {
+    printf("Contenido del archivo empacado:\n");
+    printf("-------------------------------\n");
+    return pipe_read_archive(archive_name, NULL, 0, PIPE_LIST, verbose);
+}
 
-        for (size_t j = 0; j < fat.num_files; j++) {
-            if (strcmp(fat.files[j].filename, filename) == 0) {
-                file_found = true;
+#define CACHE_NONE ((size_t)-1)
 
-                // Marcar los bloques anteriores como libres
-                for (size_t k = 0; k < fat.files[j].num_blocks; k++) {
-                    fat.free_blocks[fat.num_free_blocks++] = fat.files[j].block_positions[k];
-                    if (very_verbose) {
-                        printf("Bloque %zu del archivo '%s' marcado como libre.\n", fat.files[j].block_positions[k], filename);
-                    }
-                }
+typedef struct {
+    size_t member; // índice en la FAT
+    size_t block;
+    size_t length;
+    unsigned char *data; // bloque descomprimido
+    size_t hash_next; // siguiente en la misma cubeta
+    size_t prev; // lista LRU, el mas reciente al frente
+    size_t next;
+} CacheEntry;
 
-                // Leer el contenido actualizado del archivo
-                FILE *input_file = fopen(filename, "rb");
-                if (input_file == NULL) {
-                    fprintf(stderr, "Error al abrir el archivo de entrada: %s\n", filename);
-                    continue;
-                }
+typedef struct {
+    CacheEntry *entries;
+    size_t capacity; // bloques
+    size_t count;
+    size_t *buckets;
+    size_t num_buckets; // potencia de 2
+    size_t head;
+    size_t tail;
+    pthread_mutex_t lock;
+} BlockCache;
 
-                size_t file_size = 0;
-                size_t block_count = 0;
-                Block block;
-                size_t bytes_read;
-                while ((bytes_read = fread(&block, 1, sizeof(Block), input_file)) > 0) {
-                    size_t block_position = find_free_block(&fat);
-                    if (block_position == (size_t)-1) {
-                        expand_archive(archive, &fat);
-                        block_position = find_free_block(&fat);
-                    }
+struct StarArchive {
+    Archive ar;
+    BlockCache cache;
+};
 
-                    write_block(archive, &block, block_position);
-                    fat.files[j].block_positions[block_count++] = block_position;
+void cache_init(BlockCache *cache, size_t capacity) {
+    memset(cache, 0, sizeof(BlockCache));
+    cache->capacity = capacity;
+    cache->head = cache->tail = CACHE_NONE;
+    pthread_mutex_init(&cache->lock, NULL);
+    if (capacity == 0) return;
+    cache->entries = xrealloc(NULL, capacity * sizeof(CacheEntry));
+    cache->num_buckets = 16;
+    while (cache->num_buckets < capacity * 2) cache->num_buckets *= 2;
+    cache->buckets = xrealloc(NULL, cache->num_buckets * sizeof(size_t));
+    for (size_t i = 0; i < cache->num_buckets; i++) cache->buckets[i] = CACHE_NONE;
+}
 
-                    file_size += bytes_read;
+void cache_free(BlockCache *cache) {
+    for (size_t i = 0; i < cache->count; i++) free(cache->entries[i].data);
+    free(cache->entries);
+    free(cache->buckets);
+    pthread_mutex_destroy(&cache->lock);
+}
 
-                    if (very_verbose) {
-                        printf("Bloque %zu del archivo '%s' actualizado en la posición %zu\n", block_count, filename, block_position);
-                    }
-                }
+size_t cache_bucket(BlockCache *cache, size_t member, size_t block) {
+    uint64_t h = (member * HASH_PRIME1) ^ (block * HASH_PRIME2);
+    return (h ^ (h >> 29)) & (cache->num_buckets - 1);
+}
 
-                fat.files[j].file_size = file_size;
-                fat.files[j].num_blocks = block_count;
+size_t cache_find(BlockCache *cache, size_t member, size_t block) {
+    for (size_t i = cache->buckets[cache_bucket(cache, member, block)]; i != CACHE_NONE; i = cache->entries[i].hash_next) {
+        if (cache->entries[i].member == member && cache->entries[i].block == block) return i;
+    }
+    return CACHE_NONE;
+}
 
-                fclose(input_file);
+void cache_unlink(BlockCache *cache, size_t i) {
+    CacheEntry *e = &cache->entries[i];
+    if (e->prev != CACHE_NONE) cache->entries[e->prev].next = e->next;
+    else cache->head = e->next;
+    if (e->next != CACHE_NONE) cache->entries[e->next].prev = e->prev;
+    else cache->tail = e->prev;
+}
 
-                if (verbose) {
-                    printf("Archivo '%s' actualizado en el archivo empacado.\n", filename);
-                }
+void cache_push_front(BlockCache *cache, size_t i) {
+    CacheEntry *e = &cache->entries[i];
+    e->prev = CACHE_NONE;
+    e->next = cache->head;
+    if (cache->head != CACHE_NONE) cache->entries[cache->head].prev = i;
+    cache->head = i;
+    if (cache->tail == CACHE_NONE) cache->tail = i;
+}
 
-                break;
-            }
-        }
+bool cache_read(BlockCache *cache, size_t member, size_t block, size_t offset, unsigned char *out, size_t length) {
+    // se copia bajo el candado para que otro hilo no reemplace el bloque mientras tanto
+    if (cache->capacity == 0) return false;
+    pthread_mutex_lock(&cache->lock);
+    size_t i = cache_find(cache, member, block);
+    if (i != CACHE_NONE) {
+        memcpy(out, cache->entries[i].data + offset, length);
+        cache_unlink(cache, i);
+        cache_push_front(cache, i);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return i != CACHE_NONE;
+}
 
-        if (!file_found) {
-            fprintf(stderr, "Archivo '%s' no encontrado en el archivo empacado.\n", filename);
-        }
+void cache_insert(BlockCache *cache, size_t member, size_t block, const unsigned char *data, size_t length, size_t block_size) {
+    if (cache->capacity == 0) return;
+    pthread_mutex_lock(&cache->lock);
+    if (cache_find(cache, member, block) != CACHE_NONE) {
+        pthread_mutex_unlock(&cache->lock); // otro hilo lo leyó al mismo tiempo
+        return;
     }
 
-    // Escribir la estructura FAT actualizada en el archivo
-    fseek(archive, 0, SEEK_SET);
-    fwrite(&fat, sizeof(FAT), 1, archive);
+    size_t i;
+    if (cache->count < cache->capacity) {
+        i = cache->count++;
+        cache->entries[i].data = xrealloc(NULL, block_size);
+    } else {
+        // reutilizar el menos usado: sacarlo de su cubeta y de la lista
+        i = cache->tail;
+        CacheEntry *old = &cache->entries[i];
+        size_t *link = &cache->buckets[cache_bucket(cache, old->member, old->block)];
+        while (*link != i) link = &cache->entries[*link].hash_next;
+        *link = old->hash_next;
+        cache_unlink(cache, i);
+    }
 
-    fclose(archive);
+    CacheEntry *e = &cache->entries[i];
+    e->member = member;
+    e->block = block;
+    e->length = length;
+    memcpy(e->data, data, length);
+    size_t bucket = cache_bucket(cache, member, block);
+    e->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = i;
+    cache_push_front(cache, i);
+    pthread_mutex_unlock(&cache->lock);
 }
 
-void defragment_archive(const char *archive_name, bool verbose, bool very_verbose) {
-    FILE *archive = fopen(archive_name, "rb+");
-    if (archive == NULL) {
-        fprintf(stderr, "Error al abrir el archivo empacado.\n");
-        return;
+StarArchive *star_open(const char *path, size_t cache_size) {
+    StarArchive *archive = xrealloc(NULL, sizeof(StarArchive));
+    if (!archive_open(&archive->ar, path, false)) {
+        free(archive);
+        return NULL;
     }
+    cache_init(&archive->cache, cache_size / archive->ar.sb.block_size);
+    return archive;
+}
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, archive);
+void star_close(StarArchive *archive) {
+    if (archive == NULL) return;
+    cache_free(&archive->cache);
+    archive_close(&archive->ar);
+    free(archive);
+}
+
+void star_fill_stat(FileEntry *entry, StarStat *st) {
+    st->name = entry->filename;
+    st->size = entry->file_size;
+    st->stored_size = entry->num_frames > 0 ? entry->frame_offsets[entry->num_frames] : entry->file_size;
+    st->codec = codecs[entry->codec].name;
+    st->packed = entry->packed;
+    st->has_checksums = entry->num_hashes > 0;
+}
 
-    size_t new_block_position = sizeof(FAT);
-    for (size_t i = 0; i < fat.num_files; i++) {
-        FileEntry *entry = &fat.files[i];
-        size_t file_size = 0;
+bool star_stat(StarArchive *archive, const char *name, StarStat *st) {
+    FileEntry *entry = fat_find(&archive->ar.fat, name);
+    if (entry == NULL) return false;
+    star_fill_stat(entry, st);
+    return true;
+}
 
-        for (size_t j = 0; j < entry->num_blocks; j++) {
-            Block block;
-            fseek(archive, entry->block_positions[j], SEEK_SET);
-            fread(&block, sizeof(Block), 1, archive);
+void star_iter_init(StarIterator *it, StarArchive *archive) {
+    it->archive = archive;
+    it->next = 0;
+}
 
-            fseek(archive, new_block_position, SEEK_SET);
-            fwrite(&block, sizeof(Block), 1, archive);
+bool star_iter_next(StarIterator *it, StarStat *st) {
+    FAT *fat = &it->archive->ar.fat;
+    while (it->next < fat->num_files && fat->files[it->next].deleted) it->next++;
+    if (it->next == fat->num_files) return false;
+    star_fill_stat(&fat->files[it->next++], st);
+    return true;
+}
 
-            entry->block_positions[j] = new_block_position;
-            new_block_position += sizeof(Block);
-            file_size += sizeof(Block);
+ssize_t member_pread(StarArchive *archive, FileEntry *entry, void *buffer, size_t length, uint64_t offset) {
+    Archive *ar = &archive->ar;
+    if (offset >= entry->file_size) return 0;
+    if (length > entry->file_size - offset) length = entry->file_size - offset;
 
-            if (very_verbose) {
-                printf("Bloque %zu del archivo '%s' movido a la posición %zu\n", j + 1, entry->filename, entry->block_positions[j]);
-            }
+    // sin compresión los bytes están tal cual: una lectura por extent, la caché de páginas del sistema hace el resto
+    if (entry->num_frames == 0) {
+        if (!stream_read(ar, entry, offset, buffer, length)) {
+            errno = EIO;
+            return -1;
         }
+        return length;
+    }
 
-        // no actualizar tamanio entry->file_size = file_size;
-
-        if (verbose) {
-            printf("Archivo '%s' desfragmentado.\n", entry->filename);
+    // comprimido o con huecos: bloque por bloque, los descomprimidos quedan en la caché para las lecturas siguientes
+    size_t block_size = ar->sb.block_size;
+    size_t member = entry - ar->fat.files;
+    unsigned char *out = buffer;
+    unsigned char *packed = NULL;
+    unsigned char *block = NULL;
+    size_t done = 0;
+    while (done < length) {
+        size_t i = (offset + done) / block_size;
+        size_t in_block = (offset + done) - i * block_size;
+        size_t n = block_size - in_block < length - done ? block_size - in_block : length - done;
+        if (entry->frames[i] == FRAME_HOLE) {
+            memset(out + done, 0, n);
+        } else if (!cache_read(&archive->cache, member, i, in_block, out + done, n)) {
+            if (block == NULL) {
+                packed = buffer_get(block_size);
+                block = buffer_get(block_size);
+            }
+            uint32_t frame = entry->frames[i];
+            size_t stored = frame & FRAME_SIZE_MASK;
+            size_t block_length = entry->file_size - i * block_size < block_size ? entry->file_size - i * block_size : block_size;
+            bool ok = stream_read(ar, entry, entry->frame_offsets[i], packed, stored);
+            if (ok && (frame & FRAME_RAW)) {
+                ok = stored == block_length;
+                memcpy(block, packed, block_length);
+            } else if (ok) {
+                ok = codecs[entry->codec].decompress(packed, stored, block, block_length);
+            }
+            if (!ok || (entry->num_hashes > 0 && hash_block(block, block_length) != entry->hashes[i])) {
+                buffer_put(block, block_size);
+                buffer_put(packed, block_size);
+                errno = EIO;
+                return -1;
+            }
+            cache_insert(&archive->cache, member, i, block, block_length, block_size);
+            memcpy(out + done, block + in_block, n);
         }
+        done += n;
     }
+    buffer_put(block, block_size);
+    buffer_put(packed, block_size);
+    return length;
+}
 
-    // Actualizar la estructura FAT con los nuevos bloques libres
-    fat.num_free_blocks = 0;
-    size_t remaining_space = new_block_position;
-    while (remaining_space < fat.free_blocks[fat.num_free_blocks - 1]) {
-        fat.free_blocks[fat.num_free_blocks++] = remaining_space;
-        remaining_space += sizeof(Block);
+ssize_t star_pread(StarArchive *archive, const char *name, void *buffer, size_t length, uint64_t offset) {
+    FileEntry *entry = fat_find(&archive->ar.fat, name);
+    if (entry == NULL) {
+        errno = ENOENT;
+        return -1;
     }
+    return member_pread(archive, entry, buffer, length, offset);
+}
 
-    // Escribir la estructura FAT actualizada en el archivo
-    fseek(archive, 0, SEEK_SET);
-    fwrite(&fat, sizeof(FAT), 1, archive);
+#define STARFS_NONE ((size_t)-1)
+#define STARFS_READAHEAD_MIN (256 * 1024) // primera ventana de lectura anticipada al detectar lecturas seguidas
+#define STARFS_READAHEAD_MAX (8 * 1024 * 1024) // la ventana se duplica hasta este tamaño
 
-    // Truncar el archivo para eliminar el espacio no utilizado
-    ftruncate(fileno(archive), new_block_position);
+typedef struct {
+    char *path; // relativo a la raíz, sin '/' al inicio; la raíz es ""
+    const char *name; // ultimo componente, apunta dentro de path
+    bool is_dir;
+    size_t member; // índice en la FAT si es un archivo
+    size_t first_child;
+    size_t last_child;
+    size_t next_sibling;
+} StarFsNode;
 
-    fclose(archive);
-}
+typedef struct {
+    atomic_size_t next_offset; // donde empezaría la siguiente lectura si es secuencial
+    atomic_size_t window; // bloques, 0 si no hay lectura anticipada en curso
+    atomic_size_t end; // primer bloque que todavia no se pidió
+} StarFsReadahead;
 
+struct StarFs {
+    StarArchive *archive;
+    StarFsNode *nodes; // el 0 es la raíz
+    size_t num_nodes;
+    size_t capacity;
+    size_t *buckets; // ruta -> nodo + 1
+    size_t num_buckets;
+    StarFsReadahead *readahead; // uno por archivo de la FAT
+    struct timespec mtime; // los archivos no guardan fecha, se usa la del archivo empacado
+};
 
-void append_files_to_archive(const char *archive_name, char **filenames, int num_files, bool verbose, bool very_verbose) {
-    FILE *archive = fopen(archive_name, "rb+");
-    if (archive == NULL) {
-        fprintf(stderr, "Error al abrir el archivo empacado.\n");
-        return;
+size_t starfs_normalize(const char *path, char *out) {
+    // quitar los '/' repetidos o del inicio y los componentes "."; STARFS_NONE si tiene ".."
+    size_t length = 0;
+    while (*path) {
+        while (*path == '/') path++;
+        const char *end = strchrnul(path, '/');
+        size_t n = end - path;
+        if (n == 2 && path[0] == '.' && path[1] == '.') return STARFS_NONE;
+        if (n > 0 && !(n == 1 && path[0] == '.')) {
+            if (length > 0) out[length++] = '/';
+            memcpy(out + length, path, n);
+            length += n;
+        }
+        path = end;
     }
+    out[length] = '\0';
+    return length;
+}
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, archive);
+size_t starfs_find(StarFs *fs, const char *path, size_t length) {
+    size_t mask = fs->num_buckets - 1;
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a como hash_name, pero sobre un prefijo de la ruta
+    for (size_t i = 0; i < length; i++) hash = (hash ^ (unsigned char)path[i]) * 1099511628211ULL;
+    for (size_t slot = hash & mask; fs->buckets[slot] != 0; slot = (slot + 1) & mask) {
+        StarFsNode *node = &fs->nodes[fs->buckets[slot] - 1];
+        if (strncmp(node->path, path, length) == 0 && node->path[length] == '\0') return fs->buckets[slot] - 1;
+    }
+    return STARFS_NONE;
+}
 
-    if (num_files == 0) {
-        // Leer desde la entrada estándar (stdin)
-        char *filename = "stdin";
-        size_t file_size = 0;
-        size_t block_count = 0;
-        size_t bytes_read = 0; 
-        Block block;
-        while ((bytes_read = fread(&block, 1, sizeof(Block), stdin)) > 0) {
-            size_t block_position = find_free_block(&fat);
-            if (block_position == (size_t)-1) {
-                expand_archive(archive, &fat);
-                block_position = find_free_block(&fat);
-            }
-
-            write_block(archive, &block, block_position);
-            update_fat(&fat, filename, file_size, block_position, bytes_read);
-
-            file_size += bytes_read;
-            block_count++;
+void starfs_index(StarFs *fs, size_t node) {
+    size_t mask = fs->num_buckets - 1;
+    size_t slot = hash_name(fs->nodes[node].path) & mask;
+    while (fs->buckets[slot] != 0) slot = (slot + 1) & mask;
+    fs->buckets[slot] = node + 1;
+}
 
-            if (very_verbose) {
-                printf("Bloque %zu leído desde stdin y agregado en la posición %zu\n", block_count, block_position);
-            }
-        }
+size_t starfs_add(StarFs *fs, const char *path, size_t length, size_t parent, bool is_dir, size_t member) {
+    if (fs->num_nodes == fs->capacity) {
+        fs->capacity = fs->capacity ? fs->capacity * 2 : 64;
+        fs->nodes = xrealloc(fs->nodes, fs->capacity * sizeof(StarFsNode));
+    }
+    size_t index = fs->num_nodes++;
+    StarFsNode *node = &fs->nodes[index];
+    node->path = strndup(path, length);
+    char *slash = strrchr(node->path, '/');
+    node->name = slash ? slash + 1 : node->path;
+    node->is_dir = is_dir;
+    node->member = member;
+    node->first_child = node->last_child = node->next_sibling = STARFS_NONE;
+    if (parent != STARFS_NONE) {
+        StarFsNode *p = &fs->nodes[parent];
+        if (p->last_child == STARFS_NONE) p->first_child = index;
+        else fs->nodes[p->last_child].next_sibling = index;
+        p->last_child = index;
+    }
 
-        if (verbose) {
-            printf("Contenido de stdin agregado al archivo empacado como '%s'.\n", filename);
+    // mantener la tabla a menos de la mitad de carga
+    if (fs->num_nodes * 2 > fs->num_buckets) {
+        free(fs->buckets);
+        fs->num_buckets = fs->num_buckets ? fs->num_buckets * 2 : 128;
+        fs->buckets = calloc(fs->num_buckets, sizeof(size_t));
+        if (fs->buckets == NULL) {
+            fprintf(stderr, "Error: memoria insuficiente\n");
+            exit(1);
         }
+        for (size_t i = 0; i < fs->num_nodes; i++) starfs_index(fs, i);
     } else {
-        // Agregar archivos especificados
-        for (int i = 0; i < num_files; i++) {
-            const char *filename = filenames[i];
-            FILE *input_file = fopen(filename, "rb");
-            if (input_file == NULL) {
-                fprintf(stderr, "Error al abrir el archivo de entrada: %s\n", filename);
-                continue;
-            }
-
-            size_t file_size = 0;
-            size_t bytes_read = 0;
-            size_t block_count = 0;
-            Block block;
-            while ((bytes_read = fread(&block, 1, sizeof(Block), input_file)) > 0) {
-                size_t block_position = find_free_block(&fat);
-                if (block_position == (size_t)-1) {
-                    expand_archive(archive, &fat);
-                    block_position = find_free_block(&fat);
-                }
-
-                write_block(archive, &block, block_position);
-                update_fat(&fat, filename, file_size, block_position, bytes_read);
+        starfs_index(fs, index);
+    }
+    return index;
+}
 
-                file_size += bytes_read;
-                block_count++;
+StarFs *starfs_mount(const char *archive_path, size_t cache_size) {
+    StarArchive *archive = star_open(archive_path, cache_size);
+    if (archive == NULL) return NULL;
+    StarFs *fs = calloc(1, sizeof(StarFs));
+    if (fs == NULL) {
+        fprintf(stderr, "Error: memoria insuficiente\n");
+        exit(1);
+    }
+    fs->archive = archive;
+    struct stat st;
+    if (fstat(fileno(archive->ar.file), &st) == 0) fs->mtime = st.st_mtim;
 
-                if (very_verbose) {
-                    printf("Bloque %zu del archivo '%s' agregado en la posición %zu\n", block_count, filename, block_position);
-                }
-            }
+    FAT *fat = &archive->ar.fat;
+    fs->readahead = xrealloc(NULL, (fat->num_files + 1) * sizeof(StarFsReadahead));
+    starfs_add(fs, "", 0, STARFS_NONE, true, STARFS_NONE);
 
-            fclose(input_file);
+    // los directorios salen de los nombres de los archivos, "a/b/c" crea "a" y "a/b"
+    char *path = NULL;
+    size_t path_capacity = 0;
+    for (size_t i = 0; i < fat->num_files; i++) {
+        FileEntry *entry = &fat->files[i];
+        atomic_init(&fs->readahead[i].next_offset, 0);
+        atomic_init(&fs->readahead[i].window, 0);
+        atomic_init(&fs->readahead[i].end, 0);
+        if (entry->deleted) continue;
+        size_t name_length = strlen(entry->filename);
+        if (name_length + 1 > path_capacity) {
+            path_capacity = name_length + 1;
+            path = xrealloc(path, path_capacity);
+        }
+        size_t length = starfs_normalize(entry->filename, path);
+        if (length == 0 || length == STARFS_NONE) continue; // no se puede mostrar dentro del punto de montaje
 
-            if (verbose) {
-                printf("Archivo '%s' agregado al archivo empacado.\n", filename);
+        bool is_dir = S_ISDIR(entry->metadata.mode);
+        size_t parent = 0;
+        for (size_t end = 0; parent != STARFS_NONE; end++) {
+            if (end < length && path[end] != '/') continue;
+            size_t node = starfs_find(fs, path, end);
+            if (end == length) {
+                if (node == STARFS_NONE) starfs_add(fs, path, end, parent, is_dir, i);
+                else if (is_dir && fs->nodes[node].is_dir) fs->nodes[node].member = i; // lo creó antes su contenido
+                break; // si ya existe con ese nombre el archivo queda oculto
             }
+            if (node == STARFS_NONE) node = starfs_add(fs, path, end, parent, true, STARFS_NONE);
+            parent = fs->nodes[node].is_dir ? node : STARFS_NONE;
         }
     }
-
-    // Escribir la estructura FAT actualizada en el archivo
-    fseek(archive, 0, SEEK_SET);
-    fwrite(&fat, sizeof(FAT), 1, archive);
-
-    fclose(archive);
+    free(path);
+    return fs;
 }
 
+void starfs_unmount(StarFs *fs) {
+    if (fs == NULL) return;
+    for (size_t i = 0; i < fs->num_nodes; i++) free(fs->nodes[i].path);
+    free(fs->nodes);
+    free(fs->buckets);
+    free(fs->readahead);
+    star_close(fs->archive);
+    free(fs);
+}
 
-int main(int argc, char *argv[]) {
-    struct Flags flags = {false, false, false, false, false, false, false, false, false, false, NULL, NULL, 0};
-    int opt;
+StarFsNode *starfs_lookup(StarFs *fs, const char *path) {
+    size_t length = strlen(path);
+    char *normalized = xrealloc(NULL, length + 1);
+    length = starfs_normalize(path, normalized);
+    size_t node = length == STARFS_NONE ? STARFS_NONE : starfs_find(fs, normalized, length);
+    free(normalized);
+    return node == STARFS_NONE ? NULL : &fs->nodes[node];
+}
 
-    static struct option long_options[] = {
-        {"create",      no_argument,       0, 'c'},
-        {"extract",     no_argument,       0, 'x'},
-        {"list",        no_argument,       0, 't'},
-        {"delete",      no_argument,       0, 'd'},
-        {"update",      no_argument,       0, 'u'},
-        {"verbose",     no_argument,       0, 'v'},
-        {"file",        no_argument,       0, 'f'},
-        {"append",      no_argument,       0, 'r'},
-        {"pack",        no_argument,       0, 'p'},
-        {0, 0, 0, 0}
-    };
+int starfs_getattr(StarFs *fs, const char *path, struct stat *st) {
+    StarFsNode *node = starfs_lookup(fs, path);
+    if (node == NULL) return -ENOENT;
+    memset(st, 0, sizeof(struct stat));
+    st->st_mtim = st->st_ctim = st->st_atim = fs->mtime;
+    st->st_blksize = fs->archive->ar.sb.block_size;
+    st->st_mode = node->is_dir ? S_IFDIR | 0555 : S_IFREG | 0444;
+    st->st_nlink = node->is_dir ? 2 : 1;
+    if (node->member == STARFS_NONE) return 0; // directorio que solo existe por su contenido
 
-    while ((opt = getopt_long(argc, argv, "cxtduvwfrp", long_options, NULL)) != -1) {
-        switch (opt) {
-            case 'c':
-                flags.create = true;
-                break;
-            case 'x':
-                flags.extract = true;
-                break;
-            case 't':
-                flags.list = true;
-                break;
-            case 'd':
-                flags.delete = true;
-                break;
-            case 'u':
-                flags.update = true;
-                break;
-            case 'v':
-                if (flags.verbose) {
-                    flags.veryVerbose = true;
-                }
-                flags.verbose = true;
-                break;
-            case 'f':
-                flags.file = true;
-                break;
-            case 'r':
-                flags.append = true;
-                break;
-            case 'p':
-                flags.pack = true;
-                break;
-            default:
-                fprintf(stderr, "Usage: %s [-cxtduvvfrp] <outputFile> <inputFile1> ... <inputFileN>\n", argv[0]);
-                return 1;
-        }
+    // con metadatos se muestran los guardados, sin permisos de escritura
+    FileEntry *entry = &fs->archive->ar.fat.files[node->member];
+    if (entry->metadata.mode != 0) {
+        st->st_mode = entry->metadata.mode & ~0222;
+        st->st_uid = entry->metadata.uid;
+        st->st_gid = entry->metadata.gid;
+        st->st_mtim = st->st_ctim = (struct timespec){entry->metadata.mtime, entry->metadata.mtime_nsec};
     }
+    StarStat info;
+    star_fill_stat(entry, &info);
+    st->st_size = info.size;
+    st->st_blocks = (info.stored_size + 511) / 512;
+    return 0;
+}
 
-    if (optind < argc) {
-        flags.outputFile = argv[optind++];
+int starfs_readdir(StarFs *fs, const char *path, void *buffer, StarFillDir filler) {
+    StarFsNode *node = starfs_lookup(fs, path);
+    if (node == NULL) return -ENOENT;
+    if (!node->is_dir) return -ENOTDIR;
+    if (filler(buffer, ".", NULL) != 0 || filler(buffer, "..", NULL) != 0) return 0;
+    for (size_t child = node->first_child; child != STARFS_NONE; child = fs->nodes[child].next_sibling) {
+        struct stat st;
+        starfs_getattr(fs, fs->nodes[child].path, &st);
+        if (filler(buffer, fs->nodes[child].name, &st) != 0) break; // el buffer del llamador se llenó
     }
+    return 0;
+}
+
+int starfs_readlink(StarFs *fs, const char *path, char *buffer, size_t size) {
+    // como la operación de FUSE: el destino truncado a size - 1 y terminado en '\0'
+    StarFsNode *node = starfs_lookup(fs, path);
+    if (node == NULL) return -ENOENT;
+    if (node->member == STARFS_NONE || !S_ISLNK(fs->archive->ar.fat.files[node->member].metadata.mode)) return -EINVAL;
+    if (size == 0) return -EINVAL;
+    ssize_t n = member_pread(fs->archive, &fs->archive->ar.fat.files[node->member], buffer, size - 1, 0);
+    if (n < 0) return -errno;
+    buffer[n] = '\0';
+    return 0;
+}
 
-    flags.numInputFiles = argc - optind;
-    if (flags.numInputFiles > 0) {
-        flags.inputFiles = &argv[optind];
+int starfs_open(StarFs *fs, const char *path, int flags) {
+    StarFsNode *node = starfs_lookup(fs, path);
+    if (node == NULL) return -ENOENT;
+    if (node->is_dir) return -EISDIR;
+    if ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC)) return -EROFS;
+    return 0;
+}
+
+void starfs_readahead(StarFs *fs, size_t member, size_t offset, size_t size) {
+    // lecturas seguidas: pedirle al kernel los bloques que siguen antes de que se lean, con una ventana que
+    // se duplica mientras siga el patrón; los extents son bloques consecutivos, un solo pedido por extent
+    StarFsReadahead *ra = &fs->readahead[member];
+    if (atomic_exchange(&ra->next_offset, offset + size) != offset) {
+        atomic_store(&ra->window, 0); // salto: se vuelve a empezar
+        return;
     }
 
-    if (flags.create) create_archive(flags); 
-    else if (flags.extract) extract_archive(flags.outputFile, flags.verbose, flags.veryVerbose);
-    else if (flags.delete) delete_files_from_archive(flags.outputFile, flags.inputFiles, flags.numInputFiles, flags.verbose, flags.veryVerbose);
-    else if (flags.update) update_files_in_archive(flags.outputFile, flags.inputFiles, flags.numInputFiles, flags.verbose, flags.veryVerbose);
-    else if (flags.append) append_files_to_archive(flags.outputFile, flags.inputFiles, flags.numInputFiles, flags.verbose, flags.veryVerbose);
+    Archive *ar = &fs->archive->ar;
+    FileEntry *entry = &ar->fat.files[member];
+    size_t block_size = ar->sb.block_size;
+    size_t total_blocks = blocks_for(entry->file_size, block_size);
+    size_t current = blocks_for(offset + size, block_size);
+    size_t previous = atomic_load(&ra->window);
+    size_t end = atomic_load(&ra->end);
+    if (previous != 0 && (current + previous / 2 < end || end >= total_blocks)) return; // todavia queda ventana por delante
 
-    if (flags.pack) defragment_archive(flags.outputFile, flags.verbose, flags.veryVerbose);
-    if (flags.list) list_archive_contents(flags.outputFile, flags.verbose);
+    size_t max_blocks = blocks_in(STARFS_READAHEAD_MAX, block_size);
+    size_t window = previous == 0 ? blocks_in(STARFS_READAHEAD_MIN, block_size) : previous * 2;
+    if (window > max_blocks) window = max_blocks;
+    size_t first = previous != 0 && end > current ? end : current;
+    size_t last = first + window < total_blocks ? first + window : total_blocks;
+    atomic_store(&ra->window, window);
+    atomic_store(&ra->end, last);
+    if (first >= last) return;
 
-    return 0;
+    // de bloques del archivo a bytes almacenados y de ahí a posiciones en el archivo empacado
+    size_t stream_offset = entry->num_frames > 0 ? entry->frame_offsets[first] : first * block_size;
+    size_t stream_end = entry->num_frames > 0 ? entry->frame_offsets[last] : last * block_size;
+    stream_offset += entry->data_offset;
+    stream_end += entry->data_offset;
+    size_t extent_start = 0;
+    for (size_t j = 0; j < entry->num_extents && stream_offset < stream_end; j++) {
+        size_t extent_bytes = entry->extents[j].num_blocks * block_size;
+        if (stream_offset < extent_start + extent_bytes) {
+            size_t n = extent_start + extent_bytes < stream_end ? extent_start + extent_bytes - stream_offset : stream_end - stream_offset;
+            posix_fadvise(fileno(ar->file), entry->extents[j].position + (stream_offset - extent_start), n, POSIX_FADV_WILLNEED);
+            stream_offset += n;
+        }
+        extent_start += extent_bytes;
+    }
 }
 
+int starfs_read(StarFs *fs, const char *path, char *buffer, size_t size, off_t offset) {
+    StarFsNode *node = starfs_lookup(fs, path);
+    if (node == NULL) return -ENOENT;
+    if (node->is_dir) return -EISDIR;
+    if (offset < 0) return -EINVAL;
+    starfs_readahead(fs, node->member, offset, size);
+    ssize_t n = member_pread(fs->archive, &fs->archive->ar.fat.files[node->member], buffer, size, offset);
+    return n < 0 ? -errno : (int)n;
+}
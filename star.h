@@ -0,0 +1,88 @@
+#ifndef STAR_H
+#define STAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define DEFAULT_BLOCK_SIZE (256 * 1024) // 256 KB, el tamaño se elige al crear el archivo y queda en el superbloque
+
+#define CODEC_NONE 0
+#define CODEC_LZ 1
+
+#define LIST_SORT_NONE 0 // orden del archivo empacado
+#define LIST_SORT_NAME 1
+#define LIST_SORT_SIZE 2 // de mayor a menor, y por nombre entre iguales
+
+// Lectura de archivos empacados desde otros programas, sin pasar por la línea de comandos.
+// Un StarArchive abierto se puede leer desde varios hilos a la vez; mientras está abierto
+// nadie debe modificar el archivo empacado.
+typedef struct StarArchive StarArchive;
+
+typedef struct {
+    const char *name; // vale mientras el archivo empacado siga abierto
+    uint64_t size;
+    uint64_t stored_size; // bytes que ocupa dentro del archivo empacado
+    const char *codec;
+    bool packed; // comparte su bloque con otros archivos pequeños
+    bool has_checksums; // cada bloque tiene su hash y se comprueba al leer
+} StarStat;
+
+typedef struct {
+    StarArchive *archive;
+    size_t next;
+} StarIterator;
+
+// cache_size: bytes de bloques descomprimidos que se guardan (LRU), 0 para no usar caché
+StarArchive *star_open(const char *path, size_t cache_size);
+void star_close(StarArchive *archive);
+bool star_stat(StarArchive *archive, const char *name, StarStat *st); // false si no existe
+// como pread(2): bytes leídos, 0 al final del archivo, -1 con errno (ENOENT, EIO)
+ssize_t star_pread(StarArchive *archive, const char *name, void *buffer, size_t length, uint64_t offset);
+void star_iter_init(StarIterator *it, StarArchive *archive);
+bool star_iter_next(StarIterator *it, StarStat *st); // false cuando no quedan archivos
+
+// Sistema de archivos de solo lectura sobre un archivo empacado, con la forma de las operaciones de FUSE
+// (ver mount.c): las rutas empiezan con '/', los directorios salen de los nombres de los archivos (y de los
+// directorios guardados con sus metadatos) y los errores se devuelven como -errno. Las lecturas seguidas de un archivo activan la lectura anticipada de
+// sus bloques y todos los archivos comparten la caché de bloques descomprimidos.
+typedef struct StarFs StarFs;
+typedef int (*StarFillDir)(void *buffer, const char *name, const struct stat *st); // distinto de 0 para cortar
+
+StarFs *starfs_mount(const char *archive_path, size_t cache_size);
+void starfs_unmount(StarFs *fs);
+int starfs_getattr(StarFs *fs, const char *path, struct stat *st);
+int starfs_readdir(StarFs *fs, const char *path, void *buffer, StarFillDir filler);
+int starfs_readlink(StarFs *fs, const char *path, char *buffer, size_t size);
+int starfs_open(StarFs *fs, const char *path, int flags);
+int starfs_read(StarFs *fs, const char *path, char *buffer, size_t size, off_t offset);
+
+// operaciones de la línea de comandos, cada una abre y cierra el archivo empacado
+int find_codec(const char *name);
+bool valid_block_size(size_t block_size);
+void create_archive(const char *archive_name, char **filenames, int num_files, int codec, bool dedup, size_t block_size, int jobs, bool verbose, bool very_verbose);
+bool extract_archive(const char *archive_name, char **filenames, int num_files, bool to_stdout, int jobs, bool verbose, bool very_verbose);
+// -t: patterns filtra por nombre exacto, patrón (*, ?, [...]) o directorio; false si alguno no eligió nada
+bool list_archive_contents(const char *archive_name, char **patterns, int num_patterns, int sort, bool json, bool verbose);
+bool verify_archive(const char *archive_name, int jobs, bool verbose);
+void delete_files_from_archive(const char *archive_name, char **filenames, int num_files, bool verbose, bool very_verbose);
+bool update_files_in_archive(const char *archive_name, char **filenames, int num_files, int codec, bool dedup, int jobs, bool verbose, bool very_verbose);
+bool append_files_to_archive(const char *archive_name, char **filenames, int num_files, int codec, bool dedup, int jobs, bool verbose, bool very_verbose);
+void defragment_archive(const char *archive_name, bool verbose, bool very_verbose);
+
+// --stats: contadores de E/S, tiempos por fase y fragmentación del ultimo archivo empacado cerrado; el reporte va a stderr
+void star_stats_enable(void);
+void star_stats_report(bool json);
+
+// E/S del archivo empacado: io_uring con varios pedidos en vuelo si el kernel lo tiene (uring en false fuerza
+// pread/pwrite de a uno) y O_DIRECT para los bloques alineados si direct; se llama antes de cualquier operación
+void star_io_configure(bool uring, bool direct);
+
+// formato de flujo: sin buscar en la salida ni en la entrada, el nombre "-" es la salida o la entrada estándar
+bool pipe_create_archive(const char *archive_name, char **filenames, int num_files, int codec, bool verbose);
+bool pipe_extract_archive(const char *archive_name, char **filenames, int num_files, bool to_stdout, bool verbose);
+bool pipe_list_archive(const char *archive_name, bool verbose);
+
+#endif
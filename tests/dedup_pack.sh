@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+# Regresión: empaquetar un archivo con deduplicación no debe perder bloques compartidos entre archivos.
+# Uso: tests/dedup_pack.sh [ruta a star] [directorio de trabajo]
+set -e
+
+STAR=$(realpath "${1:-./star}")
+WORK=${2:-/tmp/star-dedup-pack}
+
+rm -rf "$WORK" && mkdir -p "$WORK" && cd "$WORK"
+
+# cuatro bloques de 4 KB repartidos entre archivos que los comparten en distinto orden
+for i in 0 1 2 3; do head -c 4096 /dev/urandom > P$i; done
+cat P0 P1 P2 > a
+cat P3 P1 > b
+cat P2 P0 > c
+head -c 12288 /dev/urandom > gap
+
+# borrar "gap" deja un hueco al principio: empaquetar mueve todos los bloques compartidos
+"$STAR" -cf ar -D -b 4K gap a b c
+"$STAR" -df ar gap
+"$STAR" -pf ar
+"$STAR" -Vf ar
+
+mkdir out
+(cd out && "$STAR" -xf ../ar)
+for f in a b c; do cmp "$f" "out/$f"; done
+
+# los bloques movidos siguen disponibles para deduplicar lo que se agregue después
+"$STAR" -rf ar -D P1
+"$STAR" -Vf ar
+"$STAR" -df ar a b
+"$STAR" -pf ar
+"$STAR" -Vf ar
+rm -rf out && mkdir out
+(cd out && "$STAR" -xf ../ar)
+for f in c P1; do cmp "$f" "out/$f"; done
+
+echo "dedup_pack: OK"
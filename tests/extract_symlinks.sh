@@ -0,0 +1,27 @@
+#!/usr/bin/env bash
+# Regresión: un enlace extraído no puede hacer que un miembro posterior se escriba fuera del directorio actual.
+# Uso: tests/extract_symlinks.sh [ruta a star] [directorio de trabajo]
+set -e
+
+STAR=$(realpath "${1:-./star}")
+WORK=${2:-/tmp/star-extract-symlinks}
+
+rm -rf "$WORK" && mkdir -p "$WORK" && cd "$WORK"
+mkdir -p victim s1/d s2/d/link
+ln -s "$WORK/victim" s1/d/link
+echo fuera > s2/d/link/x
+echo dentro > s2/y
+
+# "d/link" es un enlace y después viene "d/link/x", agregado desde otro árbol donde link es un directorio
+(cd s1 && "$STAR" -cf ../ar d)
+(cd s2 && "$STAR" -rf ../ar d/link/x y)
+
+mkdir out
+if (cd out && "$STAR" -xf ../ar 2>/dev/null); then
+    echo "extract_symlinks: la extracción debía fallar" >&2
+    exit 1
+fi
+[ -z "$(ls victim)" ] || { echo "extract_symlinks: se escribió fuera del directorio" >&2; exit 1; }
+[ -L out/d/link ] && cmp s2/y out/y
+
+echo "extract_symlinks: OK"
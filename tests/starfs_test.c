@@ -0,0 +1,214 @@
+// Prueba de starfs_* sin FUSE: arma un directorio de prueba, lo empaca con cada codec y compara lo que
+// devuelve el sistema de archivos con los archivos originales.
+// Compilar: gcc -O2 -I. tests/starfs_test.c star.c -o starfs_test -lpthread
+// Uso: ./starfs_test [directorio de trabajo]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "star.h"
+
+#define BLOCK_SIZE 4096
+#define BIG_SIZE (40 * BLOCK_SIZE + 123) // el ultimo bloque queda a medias
+#define SPARSE_SIZE (64 * BLOCK_SIZE)
+
+int failures = 0;
+
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "FALLA %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        failures++; \
+    } \
+} while (0)
+
+void write_file(const char *name, const unsigned char *data, size_t length) {
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, data, length) != (ssize_t)length) {
+        fprintf(stderr, "Error al crear %s\n", name);
+        exit(1);
+    }
+    close(fd);
+}
+
+unsigned char *read_source(const char *name, size_t *length) {
+    struct stat st;
+    int fd = open(name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error al leer %s\n", name);
+        exit(1);
+    }
+    unsigned char *data = malloc(st.st_size + 1);
+    if (pread(fd, data, st.st_size, 0) != st.st_size) {
+        fprintf(stderr, "Error al leer %s\n", name);
+        exit(1);
+    }
+    close(fd);
+    *length = st.st_size;
+    return data;
+}
+
+void make_dataset(void) {
+    // big: texto que se comprime mezclado con bytes pseudoaleatorios que no, así hay frames de los dos tipos
+    unsigned char *big = malloc(BIG_SIZE);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < BIG_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        big[i] = (i / BLOCK_SIZE) % 3 == 0 ? (unsigned char)(seed >> 16) : (unsigned char)("linea de prueba\n"[i % 16]);
+    }
+    mkdir("dir", 0755);
+    mkdir("dir/sub", 0755);
+    write_file("dir/big", big, BIG_SIZE);
+    write_file("dir/small.txt", (const unsigned char *)"hola\n", 5);
+    write_file("dir/sub/empty", NULL, 0);
+    free(big);
+
+    // sparse: datos solo en el bloque 10 y en el ultimo, el resto huecos
+    int fd = open("dir/sparse", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    unsigned char block[BLOCK_SIZE];
+    memset(block, 'x', sizeof(block));
+    if (fd < 0 || ftruncate(fd, SPARSE_SIZE) != 0 || pwrite(fd, block, BLOCK_SIZE, 10 * BLOCK_SIZE) != BLOCK_SIZE ||
+        pwrite(fd, block, 100, SPARSE_SIZE - 100) != 100) {
+        fprintf(stderr, "Error al crear dir/sparse\n");
+        exit(1);
+    }
+    close(fd);
+
+    unlink("dir/link");
+    if (symlink("small.txt", "dir/link") != 0) {
+        fprintf(stderr, "Error al crear dir/link\n");
+        exit(1);
+    }
+}
+
+typedef struct {
+    char names[16][64];
+    int count;
+} DirListing;
+
+int collect(void *buffer, const char *name, const struct stat *st) {
+    (void)st;
+    DirListing *listing = buffer;
+    if (listing->count < 16) snprintf(listing->names[listing->count++], sizeof(listing->names[0]), "%s", name);
+    return 0;
+}
+
+bool listed(const DirListing *listing, const char *name) {
+    for (int i = 0; i < listing->count; i++) {
+        if (strcmp(listing->names[i], name) == 0) return true;
+    }
+    return false;
+}
+
+void check_range(StarFs *fs, const char *name, const unsigned char *source, size_t source_length, size_t offset, size_t length) {
+    // una lectura como la de FUSE: a lo sumo length bytes, menos al final del archivo
+    char path[256];
+    snprintf(path, sizeof(path), "/%s", name);
+    char *buffer = malloc(length + 1);
+    int n = starfs_read(fs, path, buffer, length, offset);
+    size_t expected = offset >= source_length ? 0 : (source_length - offset < length ? source_length - offset : length);
+    CHECK(n == (int)expected, "%s: leer %zu bytes en %zu devolvió %d, se esperaban %zu", name, length, offset, n, expected);
+    if (n == (int)expected && expected > 0) {
+        CHECK(memcmp(buffer, source + offset, expected) == 0, "%s: datos distintos en [%zu, %zu)", name, offset, offset + expected);
+    }
+    free(buffer);
+}
+
+void check_file(StarFs *fs, const char *name) {
+    size_t length;
+    unsigned char *source = read_source(name, &length);
+    char path[256];
+    snprintf(path, sizeof(path), "/%s", name);
+
+    struct stat st;
+    CHECK(starfs_getattr(fs, path, &st) == 0, "%s: getattr falló", name);
+    CHECK(S_ISREG(st.st_mode) && (st.st_mode & 0222) == 0, "%s: modo %o", name, st.st_mode);
+    CHECK((size_t)st.st_size == length, "%s: tamaño %zu, se esperaba %zu", name, (size_t)st.st_size, length);
+    CHECK(starfs_open(fs, path, O_RDONLY) == 0, "%s: open falló", name);
+    CHECK(starfs_open(fs, path, O_WRONLY) == -EROFS, "%s: open para escribir no devolvió EROFS", name);
+
+    // todo de una vez, de a trozos seguidos (activa la lectura anticipada) y cruzando cada borde de bloque,
+    // que con compresión también es borde de frame
+    check_range(fs, name, source, length, 0, length + 10);
+    for (size_t offset = 0; offset < length; offset += 1000) check_range(fs, name, source, length, offset, 1000);
+    for (size_t edge = BLOCK_SIZE; edge < length + BLOCK_SIZE; edge += BLOCK_SIZE) {
+        check_range(fs, name, source, length, edge - 7, 14);
+        check_range(fs, name, source, length, edge - 1, 2 * BLOCK_SIZE + 2);
+    }
+    check_range(fs, name, source, length, length, 10);
+    check_range(fs, name, source, length, length + BLOCK_SIZE, 10);
+    free(source);
+}
+
+void check_archive(const char *archive_name, int codec) {
+    char *inputs[] = {"dir"};
+    create_archive(archive_name, inputs, 1, codec, false, BLOCK_SIZE, 2, false, false);
+    StarFs *fs = starfs_mount(archive_name, 4 * BLOCK_SIZE); // caché chica para que se reemplacen bloques
+    CHECK(fs != NULL, "%s: no se pudo montar", archive_name);
+    if (fs == NULL) return;
+
+    // directorios: los guardados y la raíz, que sale de los nombres
+    struct stat st;
+    CHECK(starfs_getattr(fs, "/", &st) == 0 && S_ISDIR(st.st_mode), "/: no es un directorio");
+    CHECK(starfs_getattr(fs, "/dir/sub", &st) == 0 && S_ISDIR(st.st_mode), "/dir/sub: no es un directorio");
+    CHECK(starfs_getattr(fs, "/dir/nada", &st) == -ENOENT, "/dir/nada: se esperaba ENOENT");
+    CHECK(starfs_open(fs, "/dir", O_RDONLY) == -EISDIR, "/dir: open no devolvió EISDIR");
+
+    DirListing listing = {.count = 0};
+    CHECK(starfs_readdir(fs, "/", &listing, collect) == 0, "/: readdir falló");
+    CHECK(listing.count == 3 && listed(&listing, ".") && listed(&listing, "..") && listed(&listing, "dir"), "/: contenido inesperado");
+    listing.count = 0;
+    CHECK(starfs_readdir(fs, "/dir", &listing, collect) == 0, "/dir: readdir falló");
+    const char *expected[] = {"big", "small.txt", "sparse", "link", "sub"};
+    CHECK(listing.count == 7, "/dir: %d entradas, se esperaban 7", listing.count);
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) CHECK(listed(&listing, expected[i]), "/dir: falta %s", expected[i]);
+    CHECK(starfs_readdir(fs, "/dir/big", &listing, collect) == -ENOTDIR, "/dir/big: readdir no devolvió ENOTDIR");
+
+    // enlace: getattr no lo sigue y readlink devuelve el destino guardado
+    char target[64];
+    CHECK(starfs_getattr(fs, "/dir/link", &st) == 0 && S_ISLNK(st.st_mode), "/dir/link: no es un enlace");
+    CHECK(starfs_readlink(fs, "/dir/link", target, sizeof(target)) == 0 && strcmp(target, "small.txt") == 0, "/dir/link: destino incorrecto");
+    CHECK(starfs_readlink(fs, "/dir/link", target, 4) == 0 && strcmp(target, "sma") == 0, "/dir/link: truncado incorrecto");
+    CHECK(starfs_readlink(fs, "/dir/big", target, sizeof(target)) == -EINVAL, "/dir/big: readlink no devolvió EINVAL");
+
+    check_file(fs, "dir/big");
+    check_file(fs, "dir/small.txt");
+    check_file(fs, "dir/sub/empty");
+    check_file(fs, "dir/sparse");
+
+    // los huecos no ocupan lugar en el archivo empacado, si el sistema de archivos de origen los informó
+    int fd = open("dir/sparse", O_RDONLY);
+    if (fd >= 0 && lseek(fd, 0, SEEK_HOLE) == 0) {
+        CHECK(starfs_getattr(fs, "/dir/sparse", &st) == 0 && (size_t)st.st_blocks * 512 < 8 * BLOCK_SIZE,
+              "/dir/sparse: ocupa %zu bytes, los huecos se guardaron", (size_t)st.st_blocks * 512);
+    }
+    if (fd >= 0) close(fd);
+
+    starfs_unmount(fs);
+}
+
+int main(int argc, char **argv) {
+    const char *work = argc > 1 ? argv[1] : "/tmp/star-starfs-test";
+    mkdir(work, 0755);
+    if (chdir(work) != 0) {
+        fprintf(stderr, "Error al entrar en %s\n", work);
+        return 1;
+    }
+    make_dataset();
+    unlink("raw.star");
+    unlink("lz.star");
+    check_archive("raw.star", CODEC_NONE);
+    check_archive("lz.star", CODEC_LZ);
+
+    if (failures > 0) {
+        fprintf(stderr, "starfs_test: %d fallas\n", failures);
+        return 1;
+    }
+    printf("starfs_test: OK\n");
+    return 0;
+}
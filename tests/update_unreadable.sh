@@ -0,0 +1,31 @@
+#!/usr/bin/env bash
+# Regresión: un archivo que no se puede leer durante -u conserva su contenido anterior y el comando falla.
+# Uso: tests/update_unreadable.sh [ruta a star] [directorio de trabajo]
+set -e
+
+STAR=$(realpath "${1:-./star}")
+WORK=${2:-/tmp/star-update-unreadable}
+
+rm -rf "$WORK" && mkdir -p "$WORK" && cd "$WORK"
+
+# muchos archivos después de "f" para que haya confirmaciones en grupo mientras se actualizan
+head -c 3000000 /dev/urandom > f
+for i in $(seq 1 300); do head -c 300000 /dev/urandom > n$i; done
+cp f f.orig
+"$STAR" -cf ar f n*
+
+# "f" pasa a ser un directorio: abrirlo funciona pero leerlo no
+rm f && mkdir f
+for i in $(seq 1 300); do head -c 1000 /dev/urandom | dd of=n$i conv=notrunc status=none; done
+if "$STAR" -uf ar f n* 2>/dev/null; then
+    echo "update_unreadable: -u debía fallar" >&2
+    exit 1
+fi
+"$STAR" -Vf ar
+
+mkdir out
+(cd out && "$STAR" -xf ../ar)
+cmp f.orig out/f
+for i in 1 150 300; do cmp n$i out/n$i; done
+
+echo "update_unreadable: OK"